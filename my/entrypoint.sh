@@ -61,6 +61,7 @@ elif [ "$LANGUAGE" = "c" ]; then
   # -pg: gprofを使う場合のみ追加してください (perf/Valgrindなら不要)
   CFLAGS="-O3 -g" # profiling on
   # CFLAGS="" # profiling off
+  LDFLAGS="-pthread" # GCの並列マーキングでスレッドを使うため
   # --------------------------------------------------------------------
 
   cd /app/src/clox/src
@@ -80,7 +81,7 @@ elif [ "$LANGUAGE" = "c" ]; then
   # 最終的な実行ファイルをリンク
   echo "Linking executable..."
   cd /app/src/clox/bin
-  gcc $CFLAGS -o clox *.o
+  gcc $CFLAGS -o clox *.o $LDFLAGS
   echo "Created executable: /app/src/clox/bin/clox"
 
   # エイリアスの登録
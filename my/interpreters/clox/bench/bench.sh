@@ -0,0 +1,173 @@
+#!/bin/bash
+#
+# Lox のベンチマーク（lox/*.lox）を繰り返し実行し，実行時間（ミリ秒）の中央値と標準偏差を出す．
+#
+# 各ベンチマークの標準出力は，ファイル中の `// expect: ` の行と一致しなければならない（高速化で結果が変わっていないことの確認）．
+# 計測した結果は CSV で書き出せるので，それを基準値として保存しておけば，変更後の結果と中央値を比べられる．
+# 本家の clox（sample/ でビルドしたもの）を基準にして比べることもできる．@note ベンチマークは本家にもある機能しか使わない．
+#
+# Usage: ./bench.sh [options] CLOX [NAME...]
+#   -n RUNS     計測する回数（デフォルト: 5）
+#   -w WARMUP   計測前に捨てる実行の回数（デフォルト: 1）
+#   -a ARGS     CLOX に渡すオプション（e.g. -a "--gc-threads=1"．基準の clox には渡さない）
+#   -o FILE     結果を CSV で FILE に書き出す
+#   -b FILE     -o で書き出した CSV を基準値として比べる
+#   -r CLOX     別の clox を同じ条件で計測して，それを基準値として比べる
+#   -t PERCENT  中央値が基準値よりこの割合以上遅ければ劣化とみなす（デフォルト: 5）
+#
+# 終了コード: 0: 成功, 1: 劣化したベンチマークがある, 2: 出力が期待と一致しないベンチマークがある
+#
+# e.g.
+#   ./bench.sh -o /tmp/before.csv /app/src/clox/bin/clox
+#   （変更を加えてビルドし直す）
+#   ./bench.sh -b /tmp/before.csv /app/src/clox/bin/clox
+#   ./bench.sh -r /path/to/craftinginterpreters/clox /app/src/clox/bin/clox fib zoo
+
+RUNS=5
+WARMUP=1
+CLOX_ARGS=""
+OUTPUT=""
+BASELINE=""
+REFERENCE=""
+THRESHOLD=5
+
+usage() {
+  sed -n '9,17p' "$0" | sed 's/^# \{0,1\}//' >&2
+  exit 64
+}
+
+while getopts "n:w:a:o:b:r:t:" opt; do
+  case $opt in
+    n) RUNS=$OPTARG ;;
+    w) WARMUP=$OPTARG ;;
+    a) CLOX_ARGS=$OPTARG ;;
+    o) OUTPUT=$OPTARG ;;
+    b) BASELINE=$OPTARG ;;
+    r) REFERENCE=$OPTARG ;;
+    t) THRESHOLD=$OPTARG ;;
+    *) usage ;;
+  esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -lt 1 ]; then
+  usage
+fi
+if [ -n "$BASELINE" ] && [ -n "$REFERENCE" ]; then
+  echo "Error: -b と -r は同時に指定できない．" >&2
+  exit 64
+fi
+
+CLOX=$1
+shift
+
+BENCH_DIR=$(cd "$(dirname "$0")/lox" && pwd)
+if [ $# -gt 0 ]; then
+  NAMES=("$@")
+else
+  NAMES=()
+  for file in "$BENCH_DIR"/*.lox; do
+    NAMES+=("$(basename "$file" .lox)")
+  done
+fi
+
+# 実行時間（ミリ秒）の並びから，中央値・平均・標準偏差（標本）・最小・最大を求める．
+stats() {
+  tr ' ' '\n' | sort -g | awk '
+    { values[NR] = $1; sum += $1 }
+    END {
+      mean = sum / NR
+      for (i = 1; i <= NR; i++) squares += (values[i] - mean) ^ 2
+      stddev = NR > 1 ? sqrt(squares / (NR - 1)) : 0
+      median = NR % 2 == 1 ? values[(NR + 1) / 2] : (values[NR / 2] + values[NR / 2 + 1]) / 2
+      printf "%.1f %.1f %.1f %.1f %.1f\n", median, mean, stddev, values[1], values[NR]
+    }'
+}
+
+# ベンチマークを WARMUP + RUNS 回実行して，計測した時間を空白区切りで出力する．
+# @note 出力が期待と一致しなければ，何も出力せずに失敗する．
+measure() {
+  local file=$1
+  shift
+  local expected
+  expected=$(grep -o '// expect: .*' "$file" | sed 's|^// expect: ||')
+
+  local times=() i
+  for ((i = 0; i < WARMUP + RUNS; i++)); do
+    local start end output
+    start=$(date +%s%N)
+    output=$("$@" "$file" 2>/dev/null)
+    end=$(date +%s%N)
+
+    if [ "$output" != "$expected" ]; then
+      return 1
+    fi
+    if [ $i -ge "$WARMUP" ]; then
+      times+=("$(awk -v nanos=$((end - start)) 'BEGIN { printf "%.3f", nanos / 1000000 }')")
+    fi
+  done
+  echo "${times[*]}"
+}
+
+# 基準値（ベンチマーク名 -> 中央値）
+declare -A baseline
+if [ -n "$BASELINE" ]; then
+  while IFS=, read -r name runs median rest; do
+    [ "$name" = "name" ] && continue
+    baseline[$name]=$median
+  done < "$BASELINE"
+fi
+
+if [ -n "$OUTPUT" ]; then
+  echo "name,runs,median_ms,mean_ms,stddev_ms,min_ms,max_ms" > "$OUTPUT"
+fi
+
+printf "%-16s %10s %8s %10s %10s %10s %8s\n" "benchmark" "median ms" "stddev" "min" "max" "baseline" "ratio"
+
+regressed=0
+failed=0
+for name in "${NAMES[@]}"; do
+  file="$BENCH_DIR/$name.lox"
+  if [ ! -f "$file" ]; then
+    echo "Error: ベンチマーク \"$name\" が見つからない．" >&2
+    failed=1
+    continue
+  fi
+
+  # shellcheck disable=SC2086 # CLOX_ARGS はオプションごとに分割する．
+  if ! times=$(measure "$file" "$CLOX" $CLOX_ARGS); then
+    printf "%-16s %s\n" "$name" "FAILED (output does not match the expectations)"
+    failed=1
+    continue
+  fi
+  read -r median mean stddev min max <<< "$(echo "$times" | stats)"
+
+  if [ -n "$REFERENCE" ]; then
+    if referenceTimes=$(measure "$file" "$REFERENCE"); then
+      baseline[$name]=$(echo "$referenceTimes" | stats | cut -d' ' -f1)
+    else
+      echo "Warning: 基準の clox の \"$name\" の出力が期待と一致しない．" >&2
+    fi
+  fi
+
+  reference=${baseline[$name]:-}
+  if [ -n "$reference" ]; then
+    ratio=$(awk -v a="$median" -v b="$reference" 'BEGIN { printf "%.2f", a / b }')
+    verdict=$(awk -v a="$median" -v b="$reference" -v t="$THRESHOLD" 'BEGIN {
+      if (a > b * (1 + t / 100)) print "slower"; else if (a < b * (1 - t / 100)) print "faster"; else print ""
+    }')
+    [ "$verdict" = "slower" ] && regressed=1
+    printf "%-16s %10s %8s %10s %10s %10s %7sx %s\n" "$name" "$median" "$stddev" "$min" "$max" "$reference" "$ratio" "$verdict"
+  else
+    printf "%-16s %10s %8s %10s %10s %10s %8s\n" "$name" "$median" "$stddev" "$min" "$max" "-" "-"
+  fi
+
+  if [ -n "$OUTPUT" ]; then
+    echo "$name,$RUNS,$median,$mean,$stddev,$min,$max" >> "$OUTPUT"
+  fi
+done
+
+if [ $failed -ne 0 ]; then
+  exit 2
+fi
+exit $regressed
@@ -0,0 +1,133 @@
+/**
+ * 文字列のハッシュ関数のマイクロベンチマーク．
+ *
+ * 短い識別子（コンパイル時のリテラルや変数名）と，長い文字列（実行時に組み立てた文字列）それぞれについて，
+ * 以前のハッシュ関数（FNV-1a）と現在の hashString() の1回あたりの時間とスループットを比べる．
+ * あわせて，連番の識別子をハッシュ表の下位ビットで振り分けた時の偏り（最も混んだバケットの個数）も出す．
+ *
+ * @note src 以下の *.c はすべて clox 本体としてコンパイルされるので，ベンチマークは src の外に置く．
+ *
+ * Usage:
+ *  gcc -O3 -I../src -o /tmp/hash_bench hash.c ../src/hash.c && /tmp/hash_bench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hash.h"
+
+#define SHORT_COUNT 100000 // 短い識別子の個数
+#define SHORT_ROUNDS 100
+#define LONG_LENGTH (64 * 1024) // 長い文字列のバイト数
+#define LONG_ROUNDS 2000
+#define TABLE_BITS 16 // 偏りを調べるハッシュ表の大きさ（2 の TABLE_BITS 乗）
+
+/**
+ * 比較用：以前の FNV-1a
+ */
+static uint32_t hashFnv1a(const char* key, int length) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        hash ^= (uint8_t)key[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+typedef uint32_t (*HashFn)(const char* key, int length);
+
+static double nowSeconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+static volatile uint32_t sink; // 最適化でハッシュの計算が消されないようにする．
+
+static void benchShort(const char* name, HashFn hash, char** keys, int* lengths, size_t totalBytes) {
+    uint32_t accumulator = 0;
+    double start = nowSeconds();
+    for (int round = 0; round < SHORT_ROUNDS; round++) {
+        for (int i = 0; i < SHORT_COUNT; i++) {
+            accumulator += hash(keys[i], lengths[i]);
+        }
+    }
+    double elapsed = nowSeconds() - start;
+    sink = accumulator;
+
+    double calls = (double)SHORT_COUNT * SHORT_ROUNDS;
+    printf("  %-10s %7.2f ns/hash  %8.1f MB/s\n",
+        name, elapsed / calls * 1e9, (double)totalBytes * SHORT_ROUNDS / elapsed / 1e6
+    );
+}
+
+static void benchLong(const char* name, HashFn hash, const char* text) {
+    uint32_t accumulator = 0;
+    double start = nowSeconds();
+    for (int round = 0; round < LONG_ROUNDS; round++) {
+        accumulator += hash(text, LONG_LENGTH - (round & 7)); // 長さを少しずつ変えて，端数の処理も含める．
+    }
+    double elapsed = nowSeconds() - start;
+    sink = accumulator;
+
+    printf("  %-10s %7.2f us/hash  %8.1f MB/s\n",
+        name, elapsed / LONG_ROUNDS * 1e6, (double)LONG_LENGTH * LONG_ROUNDS / elapsed / 1e6
+    );
+}
+
+/**
+ * 連番の識別子を 2 の TABLE_BITS 乗のバケットに振り分けた時の，最も混んだバケットの個数を出す．
+ * @note 偏りがなければ，平均（SHORT_COUNT / 2^TABLE_BITS）から大きく外れない．
+ */
+static void distribution(const char* name, HashFn hash, char** keys, int* lengths) {
+    int size = 1 << TABLE_BITS;
+    int* buckets = calloc(size, sizeof(int));
+    int worst = 0;
+    for (int i = 0; i < SHORT_COUNT; i++) {
+        int bucket = hash(keys[i], lengths[i]) & (size - 1);
+        if (++buckets[bucket] > worst) worst = buckets[bucket];
+    }
+    free(buckets);
+
+    printf("  %-10s worst bucket %d (average %.2f)\n", name, worst, (double)SHORT_COUNT / size);
+}
+
+int main() {
+    // 短い識別子：よくある変数名に連番を付けたもの（2 〜 16 バイト程度）
+    static const char* stems[] = {"i", "x", "count", "index", "value", "getName", "initialize", "temporaryValue"};
+    int stemCount = sizeof(stems) / sizeof(stems[0]);
+    char** keys = malloc(sizeof(char*) * SHORT_COUNT);
+    int* lengths = malloc(sizeof(int) * SHORT_COUNT);
+    size_t totalBytes = 0;
+    for (int i = 0; i < SHORT_COUNT; i++) {
+        char buffer[64];
+        lengths[i] = snprintf(buffer, sizeof(buffer), "%s%d", stems[i % stemCount], i / stemCount);
+        keys[i] = strdup(buffer);
+        totalBytes += lengths[i];
+    }
+
+    // 長い文字列：出力用に組み立てたレポートのようなもの
+    char* text = malloc(LONG_LENGTH);
+    for (int i = 0; i < LONG_LENGTH; i++) {
+        text[i] = "line of report text 0123456789\n"[i % 31];
+    }
+
+    printf("short identifiers (%d keys, average %.1f bytes)\n", SHORT_COUNT, (double)totalBytes / SHORT_COUNT);
+    benchShort("fnv1a", hashFnv1a, keys, lengths, totalBytes);
+    benchShort("hashString", hashString, keys, lengths, totalBytes);
+
+    printf("long strings (%d bytes)\n", LONG_LENGTH);
+    benchLong("fnv1a", hashFnv1a, text);
+    benchLong("hashString", hashString, text);
+
+    printf("distribution of short identifiers over %d buckets\n", 1 << TABLE_BITS);
+    distribution("fnv1a", hashFnv1a, keys, lengths);
+    distribution("hashString", hashString, keys, lengths);
+
+    for (int i = 0; i < SHORT_COUNT; i++) free(keys[i]);
+    free(keys);
+    free(lengths);
+    free(text);
+    return 0;
+}
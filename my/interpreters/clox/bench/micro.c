@@ -0,0 +1,415 @@
+/**
+ * clox のランタイムの，C関数単位のマイクロベンチマーク．
+ *
+ * ハッシュ表（tableGet / tableSet），文字列のハッシュとインターン化（hashString / copyString / internString），
+ * メモリの割り当て（reallocate），命令のディスパッチ（interpret）を，Lox のプログラムに近い分布の入力で個別に測る．
+ *  - 文字列: 識別子くらいの長さ（2 〜 16 バイト程度）の名前
+ *  - ハッシュ表: インスタンスのフィールド表くらいの大きさ（1 〜 16 エントリ）の表を多数
+ *  - インターン化: よく使う名前の再利用と，使い捨ての新しい名前が混ざった，入れ替わりの激しい文字列表
+ * 端から端まで Lox のスクリプトを動かすよりノイズが少ないので，データ構造の変更の良し悪しを比べるのに使う．
+ *
+ * 各ベンチマークは，ウォームアップの後，一定時間以上かかるように回数をそろえたサンプルを繰り返し計測し，
+ * 1操作あたりの時間（ns/op）とサイクル数（cycles/op）の中央値，最小値，ばらつき（標準偏差の平均に対する割合）を出す．
+ *
+ * @note src 以下の *.c はすべて clox 本体としてコンパイルされるので，ベンチマークは src の外に置く．ref. hash.c
+ * @warning cycles/op はタイムスタンプカウンタ（TSC）で測るので，ターボなどで実際のクロックが変わると，コアのサイクル数とは一致しない．
+ *
+ * Usage:
+ *  gcc -O3 -g -I../src -o /tmp/micro micro.c $(find ../src -name '*.c' ! -name main.c) -pthread -lm && /tmp/micro [filter]
+ *  （filter を渡すと，名前にその文字列を含むベンチマークだけを実行する．e.g. /tmp/micro table）
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+#include "hash.h"
+#include "memory.h"
+#include "object.h"
+#include "table.h"
+#include "value.h"
+#include "vm.h"
+
+#define WARMUP_NANOS 100000000ull // ウォームアップに使う時間（100 ms）
+#define SAMPLE_NANOS 10000000ull // 1サンプルの最短の時間（10 ms）
+#define SAMPLES 15 // 計測するサンプル数
+
+#define KEY_COUNT 1024 // 識別子の個数
+#define TABLE_COUNT 256 // フィールド表の個数
+#define HOT_COUNT 512 // インターン化のベンチマークで繰り返し使う名前の個数
+#define FRESH_COUNT 65536 // インターン化のベンチマークで使い捨てる名前の個数
+#define CHURN_OPS 4096 // インターン化のベンチマークの1回あたりの操作数
+#define BLOCK_BATCH 256 // 割り当てのベンチマークで一度に確保しておくブロック数
+#define DISPATCH_LOOPS 100000
+#define DISPATCH_OPS_PER_LOOP 11 // ループ1周で実行する命令数（GET_LOCAL, CONSTANT, LESS, JUMP_IF_FALSE, POP, GET_LOCAL, CONSTANT, ADD, SET_LOCAL, POP, LOOP）
+
+typedef struct {
+    const char* name;
+    int param; // 各関数に渡す引数（e.g. フィールド表の大きさ）
+    void (*setup)(int param); // @note NULL なら何もしない．
+    uint64_t (*run)(int param); // 1回分の処理を行い，行った操作の数を返す．
+    void (*teardown)(int param); // @note NULL なら何もしない．
+} Benchmark;
+
+static volatile uint64_t sink; // 最適化で計測対象の処理が消されないようにする．
+
+static char* keyChars[KEY_COUNT];
+static int keyLengths[KEY_COUNT];
+static ObjString* keys[KEY_COUNT]; // インターン化済みの識別子．@note VMのスタックに積んで，GCから到達可能にしておく．
+static char* freshChars[FRESH_COUNT];
+static int freshLengths[FRESH_COUNT];
+static Table tables[TABLE_COUNT];
+
+static uint64_t nowNanos() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000ull + (uint64_t)time.tv_nsec;
+}
+
+static uint64_t nowCycles() {
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/**
+ * 再現性のある疑似乱数（xorshift）
+ */
+static uint32_t nextRandom() {
+    static uint32_t state = 2463534242u;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+/**
+ * よくある変数名に連番を付けた識別子を作る（ref. hash.c）．
+ */
+static int makeIdentifier(char* buffer, size_t size, int index) {
+    static const char* stems[] = {
+        "i", "x", "next", "count", "index", "value", "left", "right", "getName", "initialize", "temporaryValue",
+    };
+    int stemCount = sizeof(stems) / sizeof(stems[0]);
+    return snprintf(buffer, size, "%s%d", stems[index % stemCount], index / stemCount);
+}
+
+static void initKeys() {
+    for (int i = 0; i < KEY_COUNT; i++) {
+        char buffer[64];
+        keyLengths[i] = makeIdentifier(buffer, sizeof(buffer), i);
+        keyChars[i] = strdup(buffer);
+        keys[i] = copyString(keyChars[i], keyLengths[i]);
+        push(OBJ_VAL(keys[i]));
+    }
+
+    for (int i = 0; i < FRESH_COUNT; i++) {
+        char buffer[64];
+        freshLengths[i] = snprintf(buffer, sizeof(buffer), "tmp%d", i);
+        freshChars[i] = strdup(buffer);
+    }
+}
+
+/**
+ * t 番目の表の j 番目のフィールド名．@note 1つの表の中では重複しない（13 * j < 512）．
+ */
+static ObjString* fieldKey(int t, int j) {
+    return keys[(t * 7 + j * 13) % KEY_COUNT];
+}
+
+/**
+ * t 番目の表に存在しないフィールド名．
+ */
+static ObjString* missingKey(int t, int j) {
+    return keys[(t * 7 + j * 13 + KEY_COUNT / 2) % KEY_COUNT];
+}
+
+// ---- 文字列 ----
+
+static uint64_t runHashString(int param) {
+    (void)param;
+    uint64_t accumulator = 0;
+    for (int i = 0; i < KEY_COUNT; i++) {
+        accumulator += hashString(keyChars[i], keyLengths[i]);
+    }
+    sink = accumulator;
+    return KEY_COUNT;
+}
+
+/**
+ * インターン化済みの文字列を引き直す（コンパイラが識別子を読むたびに起きる）．
+ */
+static uint64_t runCopyString(int param) {
+    (void)param;
+    uint64_t accumulator = 0;
+    for (int i = 0; i < KEY_COUNT; i++) {
+        accumulator += (uintptr_t)copyString(keyChars[i], keyLengths[i]);
+    }
+    sink = accumulator;
+    return KEY_COUNT;
+}
+
+/**
+ * 文字列をその場で組み立ててからインターン化する（連結の結果を表のキーにする場合など）．
+ * @note 8 割はよく使う名前，2 割は使い捨ての名前なので，GCのたびに文字列表から死んだ文字列が取り除かれる．
+ */
+static uint64_t runInternChurn(int param) {
+    (void)param;
+    static int fresh = 0;
+    uint64_t accumulator = 0;
+
+    for (int i = 0; i < CHURN_OPS; i++) {
+        uint32_t random = nextRandom();
+        const char* chars;
+        int length;
+        if (random % 5 != 0) {
+            int index = (random >> 8) % HOT_COUNT;
+            chars = keyChars[index];
+            length = keyLengths[index];
+        } else {
+            chars = freshChars[fresh];
+            length = freshLengths[fresh];
+            fresh = (fresh + 1) % FRESH_COUNT;
+        }
+
+        ObjString* string = allocateString(length);
+        memcpy(string->chars, chars, length);
+        string->chars[length] = '\0';
+        accumulator += (uintptr_t)internString(string);
+    }
+
+    sink = accumulator;
+    return CHURN_OPS;
+}
+
+// ---- ハッシュ表 ----
+
+static void setupFields(int count) {
+    for (int t = 0; t < TABLE_COUNT; t++) {
+        initTable(&tables[t]);
+        for (int j = 0; j < count; j++) {
+            tableSet(&tables[t], fieldKey(t, j), NUMBER_VAL(j));
+        }
+    }
+}
+
+static void teardownFields(int count) {
+    (void)count;
+    for (int t = 0; t < TABLE_COUNT; t++) {
+        freeTable(&tables[t]);
+    }
+}
+
+static uint64_t runTableGetHit(int count) {
+    double accumulator = 0;
+    for (int t = 0; t < TABLE_COUNT; t++) {
+        for (int j = 0; j < count; j++) {
+            Value value;
+            if (tableGet(&tables[t], fieldKey(t, j), &value)) accumulator += AS_NUMBER(value);
+        }
+    }
+    sink = (uint64_t)accumulator;
+    return (uint64_t)TABLE_COUNT * count;
+}
+
+/**
+ * フィールドに無い名前を引く（メソッド呼び出しで，まずフィールドを探す場合など）．
+ */
+static uint64_t runTableGetMiss(int count) {
+    uint64_t accumulator = 0;
+    for (int t = 0; t < TABLE_COUNT; t++) {
+        for (int j = 0; j < count; j++) {
+            Value value;
+            accumulator += tableGet(&tables[t], missingKey(t, j), &value);
+        }
+    }
+    sink = accumulator;
+    return (uint64_t)TABLE_COUNT * count;
+}
+
+/**
+ * 既存のフィールドを上書きする．
+ */
+static uint64_t runTableSet(int count) {
+    static int round = 0;
+    round++;
+    for (int t = 0; t < TABLE_COUNT; t++) {
+        for (int j = 0; j < count; j++) {
+            tableSet(&tables[t], fieldKey(t, j), NUMBER_VAL(round));
+        }
+    }
+    return (uint64_t)TABLE_COUNT * count;
+}
+
+/**
+ * 空の表にフィールドを追加していく（初期化子でインスタンスのフィールドを設定する場合）．@note 表の拡張と解放も含む．
+ */
+static uint64_t runTableFill(int count) {
+    for (int t = 0; t < TABLE_COUNT; t++) {
+        freeTable(&tables[t]);
+        for (int j = 0; j < count; j++) {
+            tableSet(&tables[t], fieldKey(t, j), NUMBER_VAL(j));
+        }
+    }
+    return (uint64_t)TABLE_COUNT * count;
+}
+
+// ---- メモリの割り当て ----
+
+static void* blocks[BLOCK_BATCH];
+static const size_t blockSizes[] = {16, 24, 32, 48, 64, 96, 128};
+
+/**
+ * 小さなブロックをまとめて確保してから，逆順に解放する．
+ */
+static uint64_t runSmallBlocks(int isObject) {
+    int sizeCount = sizeof(blockSizes) / sizeof(blockSizes[0]);
+    for (int i = 0; i < BLOCK_BATCH; i++) {
+        size_t size = blockSizes[i % sizeCount];
+        blocks[i] = isObject ? reallocateObject(NULL, 0, size) : reallocate(NULL, 0, size);
+    }
+    for (int i = BLOCK_BATCH - 1; i >= 0; i--) {
+        size_t size = blockSizes[i % sizeCount];
+        if (isObject) {
+            reallocateObject(blocks[i], size, 0);
+        } else {
+            reallocate(blocks[i], size, 0);
+        }
+    }
+    return BLOCK_BATCH;
+}
+
+/**
+ * 動的配列を 0 から要素を追加して伸ばし，解放する（GROW_ARRAY による再割り当てを含む）．
+ */
+static uint64_t runArrayGrow(int count) {
+    for (int round = 0; round < 16; round++) {
+        ValueArray array;
+        initValueArray(&array);
+        for (int i = 0; i < count; i++) {
+            writeValueArray(&array, NUMBER_VAL(i));
+        }
+        freeValueArray(&array);
+    }
+    return (uint64_t)16 * count;
+}
+
+// ---- ディスパッチ ----
+
+/**
+ * ローカル変数だけを使うループを回して，1命令あたりの時間を測る．@note コンパイルの時間も含むが，ループに比べれば無視できる．
+ */
+static uint64_t runDispatch(int param) {
+    (void)param;
+    static char source[256];
+    if (source[0] == '\0') {
+        snprintf(source, sizeof(source),
+            "fun loop() { var i = 0; while (i < %d) { i = i + 1; } } loop();", DISPATCH_LOOPS
+        );
+    }
+    if (interpret(source) != INTERPRET_OK) exit(70);
+    return (uint64_t)DISPATCH_LOOPS * DISPATCH_OPS_PER_LOOP;
+}
+
+static Benchmark benchmarks[] = {
+    {"hashString/ident", 0, NULL, runHashString, NULL},
+    {"copyString/interned", 0, NULL, runCopyString, NULL},
+    {"internString/churn", 0, NULL, runInternChurn, NULL},
+    {"tableGet/hit-1", 1, setupFields, runTableGetHit, teardownFields},
+    {"tableGet/hit-2", 2, setupFields, runTableGetHit, teardownFields},
+    {"tableGet/hit-4", 4, setupFields, runTableGetHit, teardownFields},
+    {"tableGet/hit-8", 8, setupFields, runTableGetHit, teardownFields},
+    {"tableGet/hit-16", 16, setupFields, runTableGetHit, teardownFields},
+    {"tableGet/miss-1", 1, setupFields, runTableGetMiss, teardownFields},
+    {"tableGet/miss-16", 16, setupFields, runTableGetMiss, teardownFields},
+    {"tableSet/overwrite-4", 4, setupFields, runTableSet, teardownFields},
+    {"tableSet/overwrite-16", 16, setupFields, runTableSet, teardownFields},
+    {"tableSet/fill-4", 4, setupFields, runTableFill, teardownFields},
+    {"tableSet/fill-16", 16, setupFields, runTableFill, teardownFields},
+    {"reallocate/small", 0, NULL, runSmallBlocks, NULL},
+    {"reallocateObject/small", 1, NULL, runSmallBlocks, NULL},
+    {"reallocate/grow-64", 64, NULL, runArrayGrow, NULL},
+    {"interpret/dispatch", 0, NULL, runDispatch, NULL},
+};
+
+static int compareDoubles(const void* a, const void* b) {
+    double left = *(const double*)a;
+    double right = *(const double*)b;
+    return left < right ? -1 : left > right ? 1 : 0;
+}
+
+static void measure(Benchmark* benchmark) {
+    if (benchmark->setup != NULL) benchmark->setup(benchmark->param);
+
+    // ウォームアップ．あわせて，1サンプルが SAMPLE_NANOS 以上になる繰り返し回数を見積もる．
+    uint64_t warmupStart = nowNanos();
+    uint64_t warmupRuns = 0;
+    while (nowNanos() - warmupStart < WARMUP_NANOS) {
+        benchmark->run(benchmark->param);
+        warmupRuns++;
+    }
+    uint64_t nanosPerRun = (nowNanos() - warmupStart) / warmupRuns;
+    uint64_t repeats = SAMPLE_NANOS / (nanosPerRun > 0 ? nanosPerRun : 1) + 1;
+
+    double nanos[SAMPLES];
+    double cycles[SAMPLES];
+    for (int s = 0; s < SAMPLES; s++) {
+        uint64_t ops = 0;
+        uint64_t startCycles = nowCycles();
+        uint64_t start = nowNanos();
+        for (uint64_t r = 0; r < repeats; r++) {
+            ops += benchmark->run(benchmark->param);
+        }
+        uint64_t elapsed = nowNanos() - start;
+        uint64_t elapsedCycles = nowCycles() - startCycles;
+
+        nanos[s] = (double)elapsed / ops;
+        cycles[s] = (double)elapsedCycles / ops;
+    }
+
+    if (benchmark->teardown != NULL) benchmark->teardown(benchmark->param);
+
+    double mean = 0;
+    for (int s = 0; s < SAMPLES; s++) mean += nanos[s];
+    mean /= SAMPLES;
+    double squares = 0;
+    for (int s = 0; s < SAMPLES; s++) squares += (nanos[s] - mean) * (nanos[s] - mean);
+    double deviation = sqrt(squares / (SAMPLES - 1)) / mean * 100;
+
+    qsort(nanos, SAMPLES, sizeof(double), compareDoubles);
+    qsort(cycles, SAMPLES, sizeof(double), compareDoubles);
+
+#ifdef HAVE_TSC
+    printf("%-24s %10.2f %10.2f %7.1f%% %10.1f\n", benchmark->name, nanos[SAMPLES / 2], nanos[0], deviation, cycles[SAMPLES / 2]);
+#else
+    printf("%-24s %10.2f %10.2f %7.1f%% %10s\n", benchmark->name, nanos[SAMPLES / 2], nanos[0], deviation, "-");
+#endif
+}
+
+int main(int argc, const char* argv[]) {
+    const char* filter = argc > 1 ? argv[1] : NULL;
+
+    initVM();
+    vm.gcCompactThreshold = 0; // @warning 文字列をCのポインタで持っているので，コンパクションで動かされると困る．
+    initKeys();
+
+    printf("%-24s %10s %10s %8s %10s\n", "benchmark", "ns/op", "min ns/op", "stddev", "cycles/op");
+    int count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+    for (int i = 0; i < count; i++) {
+        if (filter != NULL && strstr(benchmarks[i].name, filter) == NULL) continue;
+        measure(&benchmarks[i]);
+    }
+
+    freeVM();
+    for (int i = 0; i < KEY_COUNT; i++) free(keyChars[i]);
+    for (int i = 0; i < FRESH_COUNT; i++) free(freshChars[i]);
+    return 0;
+}
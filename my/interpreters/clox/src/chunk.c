@@ -7,6 +7,7 @@
 void initChunk(Chunk* chunk) {
     chunk->count = 0;
     chunk->capacity = 0;
+    chunk->lineCapacity = 0;
     chunk->code = NULL;
     chunk->lines = NULL;
     initValueArray(&chunk->constants);
@@ -14,28 +15,32 @@ void initChunk(Chunk* chunk) {
 
 void freeChunk(Chunk* chunk) {
     FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    FREE_ARRAY(int, chunk->lines, chunk->lineCapacity);
     freeValueArray(&chunk->constants);
     initChunk(chunk);
 }
 
 void writeChunk(Chunk* chunk, uint8_t byte, int line) {
     // 容量が足りない場合は，より大きな配列に値をコピーし，参照を移す
+    // NOTE: 割り当てはメモリ不足で途中から抜け出すことがあるので（ref. ヒープの上限），配列を広げ終えてから総容量を更新する．
     if (chunk->capacity < chunk->count + 1) {
-        int oldCapacity = chunk->capacity;
-        chunk->capacity = GROW_CAPACITY(oldCapacity);
+        int capacity = GROW_CAPACITY(chunk->capacity);
+        if (chunk->lineCapacity < capacity) {
+            chunk->lines = GROW_ARRAY(
+                int,
+                chunk->lines,
+                chunk->lineCapacity,
+                capacity
+            );
+            chunk->lineCapacity = capacity;
+        }
         chunk->code = GROW_ARRAY(
             uint8_t,
             chunk->code,
-            oldCapacity,
-            chunk->capacity
-        );
-        chunk->lines = GROW_ARRAY(
-            int,
-            chunk->lines,
-            oldCapacity,
-            chunk->capacity
+            chunk->capacity,
+            capacity
         );
+        chunk->capacity = capacity;
     }
 
     chunk->code[chunk->count] = byte;
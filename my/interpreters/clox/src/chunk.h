@@ -25,6 +25,10 @@ typedef enum {
     OP_SET_UPVALUE, // @operand 上書きする上位値が格納されているインデックス
     OP_GET_PROPERTY, // インスタンスのプロパティ（フィールドやメソッドなど）を取得する．@operand 取得するプロパティ名が格納されている定数表のインデックス
     OP_SET_PROPERTY, // インスタンスのフィールドを上書きする．@operand 上書きするフィールド名が格納されている定数表のインデックス @note GET命令との対比を重視して，PROPERTY という命令名だが，実際に上書きできるのはフィールドのみ．
+    OP_BUILD_LIST, // スタックに積まれた要素から新しいリストを作り，要素と入れ替えてプッシュする．@operand 要素の個数
+    OP_BUILD_MAP, // スタックに積まれたキーと値の組から新しいマップを作り，それらと入れ替えてプッシュする．@operand エントリの個数
+    OP_INDEX_GET, // リストや型付き配列の要素，またはマップのキーに対応する値を取得する（リストやマップと添字はポップされる）．
+    OP_INDEX_SET, // リストや型付き配列の要素，またはマップのキーに対応する値を上書きする（リストやマップと添字はポップされ，代入した値が残る）．
     OP_GET_SUPER, // 現在のインスタンスのスーパークラスのメソッドを，束縛メソッド（ObjBoundMethod）としてスタックにプッシュする（現在のインスタンスはポップされる）．@operand メソッド名の定数表におけるインデックス
     OP_EQUAL, // == @note OP_NOT と組み合わせることで != を表現可能）
     OP_GREATER, // > @note OP_NOT と組み合わせることで <= を表現可能）
@@ -39,6 +43,7 @@ typedef enum {
     OP_JUMP, // 特定の数だけ命令をスキップする．@operand スキップする命令数（※ 2 バイト）
     OP_JUMP_IF_FALSE, // スタックから取得した値が Falsey であれば，特定の数だけ命令をスキップする．@operand スキップする命令数（※ 2 バイト）
     OP_LOOP, // 特定の数だけ命令を巻き戻す．@operand 巻き戻す命令数（※ 2 バイト）
+    OP_FOR_NUM, // 数値の for ループの更新と判定をまとめて行う．ref. 数値ループ命令 @operand カウンタのスロット + 増分の定数表インデックス + FOR_NUM_* のフラグ + 巻き戻す命令数（※ 2 バイト）
     OP_CALL, // 呼び出された関数のためのコールフレームをフレームスタックに追加する．@operand 引数の個数
     OP_INVOKE, // hoge.fuga() のような，メソッドへのアクセスとコールを連続で行う頻出パターン（= OP_GET_PROPERTY + OP_CALL）を，高速化のために一つの命令にまとめたもの．@operand プロパティ名の定数表インデックス + メソッドに渡す引数の個数
     OP_SUPER_INVOKE, // super.piyo() のような，スーパークラスメソッドへのアクセスとコールを連続で行う頻出パターン（= OP_GET_SUPER + OP_CALL）を，高速化のために一つの命令にまとめたもの．@operand メソッド名の定数表インデックス + メソッドに渡す引数の個数
@@ -46,10 +51,29 @@ typedef enum {
     OP_CLOSE_UPVALUE, // スタックトップにあるローカル変数をヒープに移す．
     OP_RETURN, // 現在の関数からリターンする．
     OP_CLASS, // 指定されたクラス名のクラスオブジェクトを作成する．@operand クラス名の定数表のインデックス．
-    OP_INHERIT, // スーパークラスのメソッドテーブルの全てのエントリをサブクラスのメソッドテーブルに追加する．
-    OP_METHOD // ハッシュテーブルにメソッドを追加する．@operand メソッド名の定数表におけるインデックス．
+    OP_INHERIT, // スーパークラスの全てのメソッドをサブクラスに引き継ぐ．
+    OP_METHOD, // ハッシュテーブルにメソッドを追加する．@operand メソッド名の定数表におけるインデックス．
+    OP_END_CLASS, // スタックトップのクラスのメソッドを仮想関数表に固め（封印し），クラスをポップする．ref. メソッドの仮想関数表
+    OPCODE_COUNT, // 命令の種類の数（命令ごとの実行回数の配列を確保するために使う）．@warning 新しい命令は，これより前に追加する．
 } OpCode;
 
+/**
+ * @note 数値ループ命令
+ *  for (var i = 0; i < n; i = i + 1) のような形のループは，普通にコンパイルすると，1周ごとに
+ *  インクリメント節（OP_GET_LOCAL, OP_CONSTANT, OP_ADD, OP_SET_LOCAL, OP_POP）と条件節（OP_GET_LOCAL, OP_GET_LOCAL, OP_LESS）の間を
+ *  OP_JUMP_IF_FALSE, OP_POP, OP_JUMP, OP_LOOP, OP_LOOP で行き来し，本文以外に十数回もディスパッチが発生する．
+ *  そこで，本文の末尾で上限を積んでから OP_FOR_NUM を1回実行するだけで，カウンタの更新，上限との比較，本文の先頭への巻き戻しを済ませる．
+ *  @note 上限は毎周積み直すので，本文の中でカウンタや上限の変数を書き換えても，元のループと同じように振る舞う．
+ *
+ *  OP_FOR_NUM のフラグ（下位 2 ビットが比較の種類，FOR_NUM_SUBTRACT はカウンタから増分を引く）．
+ */
+#define FOR_NUM_LESS 0 // i < limit
+#define FOR_NUM_LESS_EQUAL 1 // i <= limit
+#define FOR_NUM_GREATER 2 // i > limit
+#define FOR_NUM_GREATER_EQUAL 3 // i >= limit
+#define FOR_NUM_COMPARISON 3 // 比較の種類を取り出すマスク
+#define FOR_NUM_SUBTRACT 4 // i = i - step（無ければ i = i + step）
+
 /**
  * @note chunk = バイトコードのシーケンス
  * @note 動的配列にバイトコードを収めることで，
@@ -58,7 +82,8 @@ typedef enum {
  */
 typedef struct {
     int count; // 要素数（利用済みの容量）
-    int capacity; // 総容量
+    int capacity; // バイトコードの配列の総容量
+    int lineCapacity; // 行情報の配列の総容量．@note ふつうは capacity と同じだが，拡張の途中でメモリ不足になると，行情報の配列だけが先に広がっていることがある．
 
     uint8_t* code; // バイトコード（動的配列）の先頭へのポインタ．@note 実行時にサイズが変化するので，動的配列として実装し，ポインタを保持する．
     int* lines; // 各バイトコードのソースコード上での行情報（動的配列）の先頭へのポインタ．@note 実行時にサイズが変化するので，動的配列として実装し，ポインタを保持する．
@@ -22,9 +22,18 @@
  */
 #define NAN_BOXING // NaN ボックス化（タグ化）による値表現の最適化を有効化するモード．@warning 全てのCPUアーキテクチャで動作するとは限らない．
 
+/**
+ * @note スイステーブル
+ *  ハッシュ表のスロットごとに，ハッシュの上位 7 ビット（または空き）を表す 1 バイトの制御バイトを別の配列に持たせ，
+ *  探索では制御バイトを 16 個（SSE2 が使えない環境では 8 個）まとめて比較して，候補のスロットのキーだけを調べる．
+ *  キーのポインタを1つずつ比べる線形探針よりも，触るキャッシュラインが少なく，占有率を高くしても速さを保てる．
+ */
+#define SWISS_TABLE // スイステーブル方式のハッシュ表を使うモード．@note 無効にすると，墓標を使う線形探針のハッシュ表に戻る．
+
 // #define DEBUG_PRINT_CODE
 
 // #define DEBUG_TRACE_EXECUTION // オペコードやスタックの値を出力するモード．@warning 性能には悪影響を及ぼす．
+// #define DEBUG_COUNT_OPCODES // 命令ごと，連続する命令の組ごと，関数ごとの実行回数を数え，終了時にJSONで出力するモード．ref. 命令の実行回数 @warning 性能には（わずかに）悪影響を及ぼす．
 
 // #define DEBUG_STRESS_GC // GCをメモリの追加割り当てを行う度に実行し，メモリ管理のバグを見つけやすくする，ストレステストモード．@warning 性能には悪影響を及ぼす．
 // #define DEBUG_LOG_GC // 動的メモリで何か行う度に，その情報を出力するロギングモード．@warning 性能には悪影響を及ぼす．
@@ -5,9 +5,10 @@
 #include "common.h"
 #include "compiler.h"
 #include "memory.h"
+#include "profile.h"
 #include "scanner.h"
 
-#ifdef DEBUG_PRINT_CODE
+#if defined(DEBUG_PRINT_CODE) || defined(DEBUG_COUNT_OPCODES)
 #include "debug.h"
 #endif
 
@@ -235,6 +236,7 @@ static void emitReturn() {
 }
 
 static uint8_t makeConstant(Value value) {
+    writeBarrier((Obj*)current->function, value); // コンパイル中の関数オブジェクトは，すでに黒になっている（または昇格している）可能性がある．
     int constant = addConstant(currentChunk(), value);
 
     if (constant > UINT8_MAX) { // UINT8_MAX = uint8_t の最大値 = 255
@@ -300,6 +302,7 @@ static void initCompiler(Compiler* compiler, FunctionType type) {
          * ので，コピーを作成し，独自のヒープに関数名の文字列を割り当てておく必要がある．
          */
         current->function->name = copyString(parser.previous.start, parser.previous.length);
+        writeBarrier((Obj*)current->function, OBJ_VAL(current->function->name));
     }
 
     /**
@@ -336,6 +339,10 @@ static ObjFunction* endCompiler() {
     }
 #endif
 
+    profileFunction(function);
+#ifdef DEBUG_COUNT_OPCODES
+    countFunction(function);
+#endif
     current = current->enclosing;
     return function;
 }
@@ -659,6 +666,72 @@ static void dot(bool canAssign) {
     }
 }
 
+/**
+ * WARNING: "[" のトークンがすでに消費され，previous に格納されていることを前提とする．
+ * NOTE: 要素を順にスタックに積んでから，OP_BUILD_LIST でまとめて1つのリストにする．
+ */
+static void list(bool canAssign) {
+    int count = 0;
+
+    if (!check(TOKEN_RIGHT_BRACKET)) {
+        do {
+            expression();
+            if (count == 255) {
+                // NOTE: 要素数は OP_BUILD_LIST 命令のオペランドであり，1バイトまでという制限がある．
+                error("Can't have more than 255 elements in a list literal.");
+            }
+            count++;
+        } while (match(TOKEN_COMMA));
+    }
+
+    consume(TOKEN_RIGHT_BRACKET, "Expect ']' after list elements.");
+    emitBytes(OP_BUILD_LIST, (uint8_t)count);
+}
+
+/**
+ * { key: value, ... } のようなマップのリテラル
+ *
+ * WARNING: "{" のトークンがすでに消費され，previous に格納されていることを前提とする．
+ * NOTE: 文の先頭の "{" はブロックとして解析されるので，ここに来るのは式の途中に現れた場合のみ．
+ * NOTE: キーは識別子ではなく式なので，{ name: 1 } は変数 name の値をキーにする．
+ */
+static void map(bool canAssign) {
+    int count = 0;
+
+    if (!check(TOKEN_RIGHT_BRACE)) {
+        do {
+            expression();
+            consume(TOKEN_COLON, "Expect ':' after map key.");
+            expression();
+            if (count == 255) {
+                // NOTE: エントリ数は OP_BUILD_MAP 命令のオペランドであり，1バイトまでという制限がある．
+                error("Can't have more than 255 entries in a map literal.");
+            }
+            count++;
+        } while (match(TOKEN_COMMA));
+    }
+
+    consume(TOKEN_RIGHT_BRACE, "Expect '}' after map entries.");
+    emitBytes(OP_BUILD_MAP, (uint8_t)count);
+}
+
+/**
+ * hoge[i] や hoge[i] = fuga のような添字アクセス
+ *
+ * WARNING: 添字の対象となる式がすでにコンパイルされ，"[" のトークンも消費されていることを前提とする．
+ */
+static void subscript(bool canAssign) {
+    expression();
+    consume(TOKEN_RIGHT_BRACKET, "Expect ']' after index.");
+
+    if (canAssign && match(TOKEN_EQUAL)) {
+        expression();
+        emitByte(OP_INDEX_SET);
+    } else {
+        emitByte(OP_INDEX_GET);
+    }
+}
+
 static void literal(bool canAssign) {
     switch (parser.previous.type) {
         case TOKEN_FALSE: emitByte(OP_FALSE); break;
@@ -829,9 +902,12 @@ static void unary(bool canAssign) {
 ParseRule rules[] = {
     [TOKEN_LEFT_PAREN]    = {grouping, call,   PREC_CALL},
     [TOKEN_RIGHT_PAREN]   = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_LEFT_BRACE]    = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_LEFT_BRACE]    = {map,      NULL,   PREC_NONE},
     [TOKEN_RIGHT_BRACE]   = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_LEFT_BRACKET]  = {list,     subscript, PREC_CALL},
+    [TOKEN_RIGHT_BRACKET] = {NULL,     NULL,   PREC_NONE},
     [TOKEN_COMMA]         = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_COLON]         = {NULL,     NULL,   PREC_NONE},
     [TOKEN_DOT]           = {NULL,     dot,    PREC_CALL},
     [TOKEN_MINUS]         = {unary,    binary, PREC_TERM},
     [TOKEN_PLUS]          = {NULL,     binary, PREC_TERM},
@@ -1004,7 +1080,7 @@ static void classDeclaration() {
         method();
     }
     consume(TOKEN_RIGHT_BRACE, "Expect '}' after class body.");
-    emitByte(OP_POP);
+    emitByte(OP_END_CLASS); // メソッドが出揃ったので封印し，クラスをポップする．
 
     if (classCompiler.hasSuperclass) {
         endScope();
@@ -1058,6 +1134,129 @@ static void expressionStatement() {
     emitByte(OP_POP);
 }
 
+/**
+ * 数値の for ループの形．ref. 数値ループ命令
+ */
+typedef struct {
+    uint8_t slot; // カウンタのローカル変数のスロット
+    uint8_t step; // 増分の定数表インデックス
+    uint8_t flags; // FOR_NUM_* のフラグ
+    uint8_t limit[2]; // 上限を積む命令（オペランドを含めて2バイト）
+} NumericLoop;
+
+/**
+ * コンパイル済みの条件節とインクリメント節のバイトコードが，数値の for ループの形かどうかを調べる．
+ *
+ * @note 1パスのコンパイラで先読みをせずに済むよう，構文ではなく出力したバイトコードの並びで判定する．
+ *  条件節:           OP_GET_LOCAL i, <上限>, 比較演算（<, <=, >, >=）
+ *  インクリメント節: OP_GET_LOCAL i, OP_CONSTANT <数値>, OP_ADD か OP_SUBTRACT, OP_SET_LOCAL i, OP_POP
+ *  上限は，副作用が無く，カウンタの更新に影響されない命令（定数か，カウンタ以外の変数の読み出し）に限る．
+ *
+ * @return true: 数値の for ループの形だった（loop にその情報を格納した）．
+ */
+static bool matchNumericLoop(int conditionStart, int conditionEnd, int incrementStart, int incrementEnd, NumericLoop* loop) {
+    uint8_t* code = currentChunk()->code;
+
+    // 条件節
+    int length = conditionEnd - conditionStart;
+    if (length != 5 && length != 6) return false;
+    uint8_t* condition = code + conditionStart;
+    if (condition[0] != OP_GET_LOCAL) return false;
+    loop->slot = condition[1];
+
+    switch (condition[2]) {
+        case OP_GET_LOCAL:
+            if (condition[3] == loop->slot) return false;
+            break;
+        case OP_CONSTANT:
+        case OP_GET_GLOBAL:
+        case OP_GET_UPVALUE:
+            break;
+        default:
+            return false;
+    }
+    loop->limit[0] = condition[2];
+    loop->limit[1] = condition[3];
+
+    bool negated = length == 6;
+    if (negated && condition[5] != OP_NOT) return false;
+    switch (condition[4]) {
+        case OP_LESS: loop->flags = negated ? FOR_NUM_GREATER_EQUAL : FOR_NUM_LESS; break; // @note >= は OP_LESS, OP_NOT
+        case OP_GREATER: loop->flags = negated ? FOR_NUM_LESS_EQUAL : FOR_NUM_GREATER; break; // @note <= は OP_GREATER, OP_NOT
+        default: return false;
+    }
+
+    // インクリメント節
+    if (incrementEnd - incrementStart != 8) return false;
+    uint8_t* increment = code + incrementStart;
+    if (
+        increment[0] != OP_GET_LOCAL || increment[1] != loop->slot
+        || increment[2] != OP_CONSTANT
+        || (increment[4] != OP_ADD && increment[4] != OP_SUBTRACT)
+        || increment[5] != OP_SET_LOCAL || increment[6] != loop->slot
+        || increment[7] != OP_POP
+    ) {
+        return false;
+    }
+    if (!IS_NUMBER(currentChunk()->constants.values[increment[3]])) return false;
+    loop->step = increment[3];
+    if (increment[4] == OP_SUBTRACT) loop->flags |= FOR_NUM_SUBTRACT;
+
+    return true;
+}
+
+/**
+ * 条件節とインクリメント節を巻き戻して，数値ループ命令で本文を囲み直す．ref. 数値ループ命令
+ *
+ *   <条件節>                     ← 最初の1回だけ判定する．
+ *   OP_JUMP_IF_FALSE exit
+ *   OP_POP
+ * body:
+ *   <本文>
+ *   <上限>
+ *   OP_FOR_NUM i step flags body ← 更新して判定し，続けるなら body へ巻き戻す．
+ * exit:
+ *   OP_POP                       ← 条件値をクリア
+ *
+ * WARNING: 本文の直前（")" を消費した直後）に呼ぶこと．
+ */
+static void numericForStatement(int conditionStart, int conditionEnd, NumericLoop* loop) {
+    Chunk* chunk = currentChunk();
+    uint8_t condition[6];
+    int conditionLines[6];
+    int conditionLength = conditionEnd - conditionStart;
+    memcpy(condition, chunk->code + conditionStart, conditionLength);
+    memcpy(conditionLines, chunk->lines + conditionStart, conditionLength * sizeof(int));
+    /**
+     * 本文の後ろに出力する命令も，ループのヘッダの行に帰属させる．
+     *
+     * @note emitByte は直前のトークンの行を使うので，そのままだと本文の最後の行になり，
+     *       限界値や OP_FOR_NUM で起きた実行時エラーが，ヘッダではなく本文の行で報告されてしまう．
+     */
+    int headerLine = conditionLines[0];
+    chunk->count = conditionStart;
+
+    // 条件節は，元の行情報ごと出力し直す．
+    for (int i = 0; i < conditionLength; i++) writeChunk(chunk, condition[i], conditionLines[i]);
+    int exitJump = emitJump(OP_JUMP_IF_FALSE);
+    emitByte(OP_POP);
+
+    int bodyStart = currentChunk()->count;
+    statement();
+
+    int offset = currentChunk()->count + 8 - bodyStart; // 8 は本文の後ろに出力する命令の長さ．OP_FOR_NUM の巻き戻し量のオペランドまで含めて飛び越える．
+    if (offset > UINT16_MAX) error("Loop body too large");
+    uint8_t tail[] = {
+        loop->limit[0], loop->limit[1],
+        OP_FOR_NUM, loop->slot, loop->step, loop->flags,
+        (offset >> 8) & 0xff, offset & 0xff,
+    };
+    for (int i = 0; i < (int)sizeof(tail); i++) writeChunk(currentChunk(), tail[i], headerLine);
+
+    patchJump(exitJump);
+    emitByte(OP_POP); // ループを抜ける前に条件値をクリア
+}
+
 static void forStatement() {
     /**
      * 変数宣言が行われる可能性があるため，
@@ -1080,9 +1279,11 @@ static void forStatement() {
     // 条件節
     int loopStart = currentChunk()->count;
     int exitJump = -1;
+    int conditionEnd = -1;
     if (!match(TOKEN_SEMICOLON)) {
         expression();
         consume(TOKEN_SEMICOLON, "Expect ';' after loop condition.");
+        conditionEnd = currentChunk()->count;
         /**
          * この時点で条件節の結果がスタックトップに置かれている状態．
          * それが false であれば，ジャンプしてループを脱出する．
@@ -1106,6 +1307,14 @@ static void forStatement() {
         emitByte(OP_POP); // インクリメント節は副作用のための式なので，結果は棄てる．
         consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
 
+        // 数値の for ループであれば，専用の命令でコンパイルし直す．ref. 数値ループ命令
+        NumericLoop loop;
+        if (conditionEnd != -1 && matchNumericLoop(loopStart, conditionEnd, incrementStart, currentChunk()->count, &loop)) {
+            numericForStatement(loopStart, conditionEnd, &loop);
+            endScope();
+            return;
+        }
+
         emitLoop(loopStart); // 条件節へループバック
         loopStart = incrementStart; // ループバック先の上書き
 
@@ -1285,3 +1494,9 @@ void markCompilerRoots() {
         compiler = compiler->enclosing;
     }
 }
+
+void abortCompile() {
+    // 途中まで作った関数は，どこからも参照されなくなるので，GCに回収させる．
+    current = NULL;
+    currentClass = NULL;
+}
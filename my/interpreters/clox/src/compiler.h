@@ -12,4 +12,11 @@ ObjFunction* compile(const char* source);
 
 void markCompilerRoots();
 
+/**
+ * コンパイルを途中で打ち切った後に，コンパイラの状態を初期化する．
+ *
+ * @note メモリ不足で，コンパイルの途中から抜け出した場合に使う．ref. ヒープの上限
+ */
+void abortCompile();
+
 #endif
@@ -120,6 +120,14 @@ int disassembleInstruction(Chunk* chunk, int offset) {
             return constantInstruction("OP_GET_PROPERTY", chunk, offset);
         case OP_SET_PROPERTY:
             return constantInstruction("OP_SET_PROPERTY", chunk, offset);
+        case OP_BUILD_LIST:
+            return byteInstruction("OP_BUILD_LIST", chunk, offset);
+        case OP_BUILD_MAP:
+            return byteInstruction("OP_BUILD_MAP", chunk, offset);
+        case OP_INDEX_GET:
+            return simpleInstruction("OP_INDEX_GET", offset);
+        case OP_INDEX_SET:
+            return simpleInstruction("OP_INDEX_SET", offset);
         case OP_GET_SUPER:
             return constantInstruction("OP_GET_SUPER", chunk, offset);
 
@@ -155,6 +163,17 @@ int disassembleInstruction(Chunk* chunk, int offset) {
             return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
         case OP_LOOP:
             return jumpInstruction("OP_LOOP", -1, chunk, offset);
+        case OP_FOR_NUM: {
+            uint8_t slot = chunk->code[offset + 1];
+            uint8_t step = chunk->code[offset + 2];
+            uint8_t flags = chunk->code[offset + 3];
+            uint16_t jump = (uint16_t)((chunk->code[offset + 4] << 8) | chunk->code[offset + 5]);
+            static const char* comparisons[] = {"<", "<=", ">", ">="};
+            printf("%-16s %4d %s= ", "OP_FOR_NUM", slot, flags & FOR_NUM_SUBTRACT ? "-" : "+");
+            printValue(chunk->constants.values[step]);
+            printf(" %s -> %d\n", comparisons[flags & FOR_NUM_COMPARISON], offset + 6 - jump);
+            return offset + 6;
+        }
         case OP_CALL:
             return byteInstruction("OP_CALL", chunk, offset);
         case OP_INVOKE:
@@ -192,8 +211,171 @@ int disassembleInstruction(Chunk* chunk, int offset) {
             return simpleInstruction("OP_INHERIT", offset);
         case OP_METHOD:
             return constantInstruction("OP_METHOD", chunk, offset);
+        case OP_END_CLASS:
+            return simpleInstruction("OP_END_CLASS", offset);
         default:
             printf("Unknown opcode %d\n", instruction);
             return offset + 1;
     }
 }
+
+#ifdef DEBUG_COUNT_OPCODES
+#include <stdlib.h>
+#include <string.h>
+
+uint64_t opcodeCounts[OPCODE_COUNT];
+uint64_t opcodePairCounts[OPCODE_COUNT][OPCODE_COUNT];
+uint64_t* functionCounts = NULL;
+int previousOpcode = -1;
+
+/**
+ * 関数ごとの実行回数の表に載せる関数の情報．@note 関数オブジェクトはGCで解放されうるので，名前などは複製して持っておく．
+ */
+typedef struct {
+    char* name;
+    int line; // 関数の本文の先頭の行
+} CountedFunction;
+
+static CountedFunction* countedFunctions = NULL;
+static int countedCount = 0;
+static int countedCapacity = 0;
+
+static const char* opcodeNames[OPCODE_COUNT] = {
+    [OP_CONSTANT] = "OP_CONSTANT",
+    [OP_NIL] = "OP_NIL",
+    [OP_TRUE] = "OP_TRUE",
+    [OP_FALSE] = "OP_FALSE",
+    [OP_POP] = "OP_POP",
+    [OP_GET_LOCAL] = "OP_GET_LOCAL",
+    [OP_SET_LOCAL] = "OP_SET_LOCAL",
+    [OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+    [OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+    [OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+    [OP_GET_UPVALUE] = "OP_GET_UPVALUE",
+    [OP_SET_UPVALUE] = "OP_SET_UPVALUE",
+    [OP_GET_PROPERTY] = "OP_GET_PROPERTY",
+    [OP_SET_PROPERTY] = "OP_SET_PROPERTY",
+    [OP_BUILD_LIST] = "OP_BUILD_LIST",
+    [OP_BUILD_MAP] = "OP_BUILD_MAP",
+    [OP_INDEX_GET] = "OP_INDEX_GET",
+    [OP_INDEX_SET] = "OP_INDEX_SET",
+    [OP_GET_SUPER] = "OP_GET_SUPER",
+    [OP_EQUAL] = "OP_EQUAL",
+    [OP_GREATER] = "OP_GREATER",
+    [OP_LESS] = "OP_LESS",
+    [OP_ADD] = "OP_ADD",
+    [OP_SUBTRACT] = "OP_SUBTRACT",
+    [OP_MULTIPLY] = "OP_MULTIPLY",
+    [OP_DIVIDE] = "OP_DIVIDE",
+    [OP_NOT] = "OP_NOT",
+    [OP_NEGATE] = "OP_NEGATE",
+    [OP_PRINT] = "OP_PRINT",
+    [OP_JUMP] = "OP_JUMP",
+    [OP_JUMP_IF_FALSE] = "OP_JUMP_IF_FALSE",
+    [OP_LOOP] = "OP_LOOP",
+    [OP_FOR_NUM] = "OP_FOR_NUM",
+    [OP_CALL] = "OP_CALL",
+    [OP_INVOKE] = "OP_INVOKE",
+    [OP_SUPER_INVOKE] = "OP_SUPER_INVOKE",
+    [OP_CLOSURE] = "OP_CLOSURE",
+    [OP_CLOSE_UPVALUE] = "OP_CLOSE_UPVALUE",
+    [OP_RETURN] = "OP_RETURN",
+    [OP_CLASS] = "OP_CLASS",
+    [OP_INHERIT] = "OP_INHERIT",
+    [OP_METHOD] = "OP_METHOD",
+    [OP_END_CLASS] = "OP_END_CLASS",
+};
+
+void countFunction(ObjFunction* function) {
+    if (countedCount == countedCapacity) {
+        countedCapacity = countedCapacity < 64 ? 64 : countedCapacity * 2;
+        countedFunctions = (CountedFunction*)realloc(countedFunctions, sizeof(CountedFunction) * countedCapacity);
+        functionCounts = (uint64_t*)realloc(functionCounts, sizeof(uint64_t) * countedCapacity);
+        if (countedFunctions == NULL || functionCounts == NULL) exit(1); // アロケーションの失敗．
+    }
+
+    const char* name = function->name != NULL ? function->name->chars : "script";
+    size_t length = strlen(name);
+    char* copy = (char*)malloc(length + 1);
+    if (copy == NULL) exit(1);
+    memcpy(copy, name, length + 1);
+
+    countedFunctions[countedCount].name = copy;
+    countedFunctions[countedCount].line = function->chunk.count > 0 ? function->chunk.lines[0] : 0;
+    functionCounts[countedCount] = 0;
+    function->countId = countedCount++;
+}
+
+/**
+ * 出力する1行分の回数．@note second は命令の組の2番目の命令（組以外では使わない）．
+ */
+typedef struct {
+    int first;
+    int second;
+    uint64_t count;
+} CountRow;
+
+static int compareCountRows(const void* a, const void* b) {
+    const CountRow* left = (const CountRow*)a;
+    const CountRow* right = (const CountRow*)b;
+    if (left->count != right->count) return left->count > right->count ? -1 : 1;
+    if (left->first != right->first) return left->first < right->first ? -1 : 1;
+    if (left->second != right->second) return left->second < right->second ? -1 : 1;
+    return 0;
+}
+
+void writeOpcodeCounts(FILE* out) {
+    CountRow* rows = (CountRow*)malloc(sizeof(CountRow) * (OPCODE_COUNT * OPCODE_COUNT + countedCount));
+    if (rows == NULL) exit(1);
+
+    uint64_t total = 0;
+    for (int i = 0; i < OPCODE_COUNT; i++) {
+        total += opcodeCounts[i];
+    }
+    fprintf(out, "{\n  \"instructions\": %llu,\n", (unsigned long long)total);
+
+    int count = 0;
+    for (int i = 0; i < OPCODE_COUNT; i++) {
+        if (opcodeCounts[i] > 0) rows[count++] = (CountRow){i, 0, opcodeCounts[i]};
+    }
+    qsort(rows, count, sizeof(CountRow), compareCountRows);
+    fprintf(out, "  \"opcodes\": [");
+    for (int i = 0; i < count; i++) {
+        fprintf(out, "%s\n    {\"opcode\": \"%s\", \"count\": %llu}",
+            i > 0 ? "," : "", opcodeNames[rows[i].first], (unsigned long long)rows[i].count
+        );
+    }
+    fprintf(out, "\n  ],\n");
+
+    count = 0;
+    for (int i = 0; i < OPCODE_COUNT; i++) {
+        for (int j = 0; j < OPCODE_COUNT; j++) {
+            if (opcodePairCounts[i][j] > 0) rows[count++] = (CountRow){i, j, opcodePairCounts[i][j]};
+        }
+    }
+    qsort(rows, count, sizeof(CountRow), compareCountRows);
+    fprintf(out, "  \"pairs\": [");
+    for (int i = 0; i < count; i++) {
+        fprintf(out, "%s\n    {\"first\": \"%s\", \"second\": \"%s\", \"count\": %llu}",
+            i > 0 ? "," : "", opcodeNames[rows[i].first], opcodeNames[rows[i].second], (unsigned long long)rows[i].count
+        );
+    }
+    fprintf(out, "\n  ],\n");
+
+    count = 0;
+    for (int i = 0; i < countedCount; i++) {
+        if (functionCounts[i] > 0) rows[count++] = (CountRow){i, 0, functionCounts[i]};
+    }
+    qsort(rows, count, sizeof(CountRow), compareCountRows);
+    fprintf(out, "  \"functions\": [");
+    for (int i = 0; i < count; i++) {
+        CountedFunction* function = &countedFunctions[rows[i].first];
+        fprintf(out, "%s\n    {\"name\": \"%s\", \"line\": %d, \"count\": %llu}",
+            i > 0 ? "," : "", function->name, function->line, (unsigned long long)rows[i].count
+        );
+    }
+    fprintf(out, "\n  ]\n}\n");
+
+    free(rows);
+}
+#endif
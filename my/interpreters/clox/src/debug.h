@@ -16,4 +16,43 @@ void disassembleChunk(Chunk* chunk, const char* name);
  */
 int disassembleInstruction(Chunk* chunk, int offset);
 
+#ifdef DEBUG_COUNT_OPCODES
+#include <stdio.h>
+
+#include "object.h"
+
+/**
+ * @note 命令の実行回数．ref. 命令の実行回数
+ *  実行時間と違って，同じスクリプトを実行すれば毎回同じ値になる（GCの動き方やマシンの負荷に左右されない）ので，
+ *  CIで総命令数を記録しておけば，ノイズなく性能の劣化を検出できる．
+ *  また，連続して実行される命令の組の回数は，スーパー命令（OP_INVOKE のように複数の命令をまとめたもの）や
+ *  クイックニング（実行時の型に特化した命令への書き換え）の候補を選ぶ根拠になる．
+ */
+
+extern uint64_t opcodeCounts[OPCODE_COUNT];
+extern uint64_t opcodePairCounts[OPCODE_COUNT][OPCODE_COUNT]; // [直前の命令][命令]
+extern uint64_t* functionCounts; // [ObjFunction の countId]
+extern int previousOpcode; // @note まだ何も実行していなければ -1
+
+/**
+ * 命令を実行する直前に呼び，その命令を数える．
+ */
+static inline void countInstruction(ObjFunction* function, uint8_t opcode) {
+    opcodeCounts[opcode]++;
+    if (previousOpcode >= 0) opcodePairCounts[previousOpcode][opcode]++;
+    previousOpcode = opcode;
+    functionCounts[function->countId]++;
+}
+
+/**
+ * コンパイルし終えた関数に，関数ごとの実行回数の表の通し番号を振る．
+ */
+void countFunction(ObjFunction* function);
+
+/**
+ * 実行回数を JSON で出力する．@note 回数の降順（同じ回数なら命令や関数の番号順）に並べるので，同じ実行なら出力も一致する．
+ */
+void writeOpcodeCounts(FILE* out);
+#endif
+
 #endif
@@ -0,0 +1,99 @@
+#include <string.h>
+
+#include "hash.h"
+
+/**
+ * @note ワード単位のハッシュ関数（wyhash 系）
+ *  FNV-1a は1バイトごとに乗算を行い，しかも前の結果に依存するので，長い文字列ほど遅くなる．
+ *  そこで，8 バイト（ワード）ずつ読み込み，64 ビット同士の乗算の 128 ビットの結果の上位と下位を XOR で畳み込んで混ぜる．
+ *  長い文字列は 3 本の独立した系列に分けて 48 バイトずつ進めるので，乗算のレイテンシを隠せる．
+ *  識別子のような 16 バイト以下の短い文字列は，ループに入らず，重なりを許した数回の読み込みだけで済ませる．
+ *
+ * @warning __uint128_t は GCC / Clang の拡張．
+ */
+
+// 混ぜるための定数（奇数で，ビットの 0 と 1 が程よく混ざったもの）
+#define HASH_SECRET0 0x2d358dccaa6c78a5ull
+#define HASH_SECRET1 0x8bb84b93962eacc9ull
+#define HASH_SECRET2 0x4b33a62ed433d4a3ull
+#define HASH_SECRET3 0x4d5a2da51de1aa47ull
+
+/**
+ * 64 ビット同士の乗算の結果（128 ビット）の上位と下位を XOR で畳み込む．
+ */
+static inline uint64_t mix(uint64_t a, uint64_t b) {
+    __uint128_t product = (__uint128_t)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+// @note アラインされていない位置からも読めるように memcpy を使う（コンパイラが1命令に最適化する）．
+static inline uint64_t read64(const uint8_t* p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint64_t read32(const uint8_t* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+/**
+ * 1 〜 3 バイトを，先頭・中央・末尾のバイトから組み立てる．@note 長さによってバイトが重複するが，長さも最後に混ぜるので問題ない．
+ */
+static inline uint64_t read1to3(const uint8_t* p, size_t length) {
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[length >> 1] << 8) | p[length - 1];
+}
+
+uint32_t hashString(const char* key, int length) {
+    const uint8_t* p = (const uint8_t*)key;
+    size_t remaining = (size_t)length;
+    uint64_t seed = mix(HASH_SECRET0, HASH_SECRET1);
+    uint64_t a, b;
+
+    if (remaining <= 16) {
+        if (remaining >= 4) {
+            // 先頭と末尾から 4 バイトずつ（8 バイト以上なら中央寄りからも）読む．@note 読む範囲が重なってもよい．
+            size_t middle = (remaining >> 3) << 2;
+            a = (read32(p) << 32) | read32(p + middle);
+            b = (read32(p + remaining - 4) << 32) | read32(p + remaining - 4 - middle);
+        } else if (remaining > 0) {
+            a = read1to3(p, remaining);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        if (remaining > 48) {
+            // 3 本の独立した系列で，48 バイトずつ進める．
+            uint64_t seed1 = seed;
+            uint64_t seed2 = seed;
+            do {
+                seed = mix(read64(p) ^ HASH_SECRET1, read64(p + 8) ^ seed);
+                seed1 = mix(read64(p + 16) ^ HASH_SECRET2, read64(p + 24) ^ seed1);
+                seed2 = mix(read64(p + 32) ^ HASH_SECRET3, read64(p + 40) ^ seed2);
+                p += 48;
+                remaining -= 48;
+            } while (remaining > 48);
+            seed ^= seed1 ^ seed2;
+        }
+        while (remaining > 16) {
+            seed = mix(read64(p) ^ HASH_SECRET1, read64(p + 8) ^ seed);
+            p += 16;
+            remaining -= 16;
+        }
+        // 最後の 16 バイト（前のブロックと重なってもよい）
+        a = read64(p + remaining - 16);
+        b = read64(p + remaining - 8);
+    }
+
+    uint64_t hash = mix(a ^ HASH_SECRET1, b ^ seed);
+    hash = mix(hash ^ HASH_SECRET0 ^ (uint64_t)length, HASH_SECRET1);
+    return (uint32_t)(hash ^ (hash >> 32)); // 上位のビットも下位に畳み込んで 32 ビットにする．
+}
+
+uint32_t hashBits(uint64_t bits) {
+    uint64_t hash = mix(bits ^ HASH_SECRET0, HASH_SECRET1);
+    return (uint32_t)(hash ^ (hash >> 32));
+}
@@ -0,0 +1,18 @@
+#ifndef clox_hash_h
+#define clox_hash_h
+
+#include "common.h"
+
+/**
+ * 文字列のハッシュ値を求める．
+ *
+ * @note ハッシュ表（Table）は下位ビットでインデックスを決めるので，どのビットもよく混ざった 32 ビットの値を返す．
+ */
+uint32_t hashString(const char* key, int length);
+
+/**
+ * 64 ビットの値（数値のビット表現やポインタなど）のハッシュ値を求める．
+ */
+uint32_t hashBits(uint64_t bits);
+
+#endif
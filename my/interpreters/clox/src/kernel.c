@@ -0,0 +1,470 @@
+#include "kernel.h"
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#define KERNEL_X86 // SSE2 は x86-64 なら必ず使えるので，AVX2 だけ実行時に確かめる．
+#endif
+
+/**
+ * 積と和を FMA 命令に融合させない．@note 融合すると丸めが1回になり，Lox の a * b + c や，融合されなかった版と結果が食い違う．
+ */
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC optimize("fp-contract=off")
+#elif defined(__clang__)
+#pragma clang fp contract(off)
+#endif
+
+#define REDUCTION_LANES 8 // 総和などの集約で，独立に累積する要素の本数．@note AVX2 版の 4 要素 × 2 本に合わせる．
+
+/**
+ * @note 集約の順序．
+ *  浮動小数点数の加算は結合的でないので，足す順序が変わると結果の最後の桁が変わりうる（打ち消し合う値があれば，それ以上に変わる）．
+ *  そこで，どの版も次の同じ順序で集約し，--simd の指定やCPUによらず，同じ結果を返すようにする．
+ *
+ *   1. 先頭から REDUCTION_LANES 要素ずつ，i % REDUCTION_LANES 番目の累積値に足し込む．
+ *   2. 累積値を reduceSum などの決まった形の木で1つにまとめる．
+ *   3. 端数の要素を，先頭から順に足す．
+ *
+ *  SIMD 版は，累積レジスタの各レーンがそれぞれの累積値になるように読み込み，手順 2 ではレーンを配列に書き出して，スカラー版と同じ関数でまとめる．
+ */
+
+/**
+ * @note _mm_min_pd / _mm_max_pd と同じ規約（x が真に小さく／大きくなければ y）．
+ *       NaN や符号の違うゼロを比べた時の結果も，これで SIMD 版と一致する．
+ */
+static inline double minOf(double x, double y) {
+    return x < y ? x : y;
+}
+
+static inline double maxOf(double x, double y) {
+    return x > y ? x : y;
+}
+
+// (0,4) (1,5) (2,6) (3,7) → (0,2) (1,3) → (0,1) の順にまとめる．@note AVX2 版の2本のレジスタの和 → 上下の半分の和 → 2 レーンの和と同じ形．
+
+static double reduceSum(double* lanes) {
+    for (int k = 0; k < 4; k++) lanes[k] += lanes[k + 4];
+    for (int k = 0; k < 2; k++) lanes[k] += lanes[k + 2];
+    return lanes[0] + lanes[1];
+}
+
+static double reduceMin(double* lanes) {
+    for (int k = 0; k < 4; k++) lanes[k] = minOf(lanes[k + 4], lanes[k]);
+    for (int k = 0; k < 2; k++) lanes[k] = minOf(lanes[k + 2], lanes[k]);
+    return minOf(lanes[1], lanes[0]);
+}
+
+static double reduceMax(double* lanes) {
+    for (int k = 0; k < 4; k++) lanes[k] = maxOf(lanes[k + 4], lanes[k]);
+    for (int k = 0; k < 2; k++) lanes[k] = maxOf(lanes[k + 2], lanes[k]);
+    return maxOf(lanes[1], lanes[0]);
+}
+
+/**
+ * @note スカラー版．どのCPUでも動く基準の実装．
+ */
+
+static void addScalar(double* dst, const double* a, const double* b, int length) {
+    for (int i = 0; i < length; i++) dst[i] = a[i] + b[i];
+}
+
+static void mulScalar(double* dst, const double* a, const double* b, int length) {
+    for (int i = 0; i < length; i++) dst[i] = a[i] * b[i];
+}
+
+static void fmaScalar(double* dst, const double* a, const double* b, const double* c, int length) {
+    for (int i = 0; i < length; i++) dst[i] = a[i] * b[i] + c[i];
+}
+
+static void scaleScalar(double* dst, const double* a, double k, int length) {
+    for (int i = 0; i < length; i++) dst[i] = a[i] * k;
+}
+
+static void offsetScalar(double* dst, const double* a, double k, int length) {
+    for (int i = 0; i < length; i++) dst[i] = a[i] + k;
+}
+
+static void fillScalar(double* dst, double value, int length) {
+    for (int i = 0; i < length; i++) dst[i] = value;
+}
+
+static double sumScalar(const double* a, int length) {
+    double lanes[REDUCTION_LANES] = {0};
+    int i = 0;
+    for (; i + REDUCTION_LANES <= length; i += REDUCTION_LANES) {
+        for (int k = 0; k < REDUCTION_LANES; k++) lanes[k] += a[i + k];
+    }
+
+    double sum = reduceSum(lanes);
+    for (; i < length; i++) sum += a[i];
+    return sum;
+}
+
+static double dotScalar(const double* a, const double* b, int length) {
+    double lanes[REDUCTION_LANES] = {0};
+    int i = 0;
+    for (; i + REDUCTION_LANES <= length; i += REDUCTION_LANES) {
+        for (int k = 0; k < REDUCTION_LANES; k++) lanes[k] += a[i + k] * b[i + k];
+    }
+
+    double sum = reduceSum(lanes);
+    for (; i < length; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+static double minScalar(const double* a, int length) {
+    double lanes[REDUCTION_LANES];
+    for (int k = 0; k < REDUCTION_LANES; k++) lanes[k] = a[0];
+    int i = 0;
+    for (; i + REDUCTION_LANES <= length; i += REDUCTION_LANES) {
+        for (int k = 0; k < REDUCTION_LANES; k++) lanes[k] = minOf(a[i + k], lanes[k]);
+    }
+
+    double min = reduceMin(lanes);
+    for (; i < length; i++) min = minOf(a[i], min);
+    return min;
+}
+
+static double maxScalar(const double* a, int length) {
+    double lanes[REDUCTION_LANES];
+    for (int k = 0; k < REDUCTION_LANES; k++) lanes[k] = a[0];
+    int i = 0;
+    for (; i + REDUCTION_LANES <= length; i += REDUCTION_LANES) {
+        for (int k = 0; k < REDUCTION_LANES; k++) lanes[k] = maxOf(a[i + k], lanes[k]);
+    }
+
+    double max = reduceMax(lanes);
+    for (; i < length; i++) max = maxOf(a[i], max);
+    return max;
+}
+
+#ifdef KERNEL_X86
+
+/**
+ * @note SSE2 版．2 要素ずつ演算する．
+ *       端数の要素はスカラー版で処理する．@note 配列はプールの刻み幅（16 バイト）でしかアラインされないので，アラインを要求しない読み書きを使う．
+ */
+
+static void addSse2(double* dst, const double* a, const double* b, int length) {
+    int i = 0;
+    for (; i + 2 <= length; i += 2) _mm_storeu_pd(dst + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    addScalar(dst + i, a + i, b + i, length - i);
+}
+
+static void mulSse2(double* dst, const double* a, const double* b, int length) {
+    int i = 0;
+    for (; i + 2 <= length; i += 2) _mm_storeu_pd(dst + i, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    mulScalar(dst + i, a + i, b + i, length - i);
+}
+
+static void fmaSse2(double* dst, const double* a, const double* b, const double* c, int length) {
+    int i = 0;
+    for (; i + 2 <= length; i += 2) {
+        __m128d product = _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i));
+        _mm_storeu_pd(dst + i, _mm_add_pd(product, _mm_loadu_pd(c + i)));
+    }
+    fmaScalar(dst + i, a + i, b + i, c + i, length - i);
+}
+
+static void scaleSse2(double* dst, const double* a, double k, int length) {
+    __m128d factor = _mm_set1_pd(k);
+    int i = 0;
+    for (; i + 2 <= length; i += 2) _mm_storeu_pd(dst + i, _mm_mul_pd(_mm_loadu_pd(a + i), factor));
+    scaleScalar(dst + i, a + i, k, length - i);
+}
+
+static void offsetSse2(double* dst, const double* a, double k, int length) {
+    __m128d term = _mm_set1_pd(k);
+    int i = 0;
+    for (; i + 2 <= length; i += 2) _mm_storeu_pd(dst + i, _mm_add_pd(_mm_loadu_pd(a + i), term));
+    offsetScalar(dst + i, a + i, k, length - i);
+}
+
+static void fillSse2(double* dst, double value, int length) {
+    __m128d broadcast = _mm_set1_pd(value);
+    int i = 0;
+    for (; i + 2 <= length; i += 2) _mm_storeu_pd(dst + i, broadcast);
+    fillScalar(dst + i, value, length - i);
+}
+
+/**
+ * @note 集約は，2 要素のレジスタ4本を累積値 0〜7 に対応させる．4 本の独立した累積レジスタに分けることで，加算のレイテンシも隠せる．ref. 集約の順序
+ */
+static double sumSse2(const double* a, int length) {
+    __m128d sum[4] = {_mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd()};
+    int i = 0;
+    for (; i + REDUCTION_LANES <= length; i += REDUCTION_LANES) {
+        for (int k = 0; k < 4; k++) sum[k] = _mm_add_pd(sum[k], _mm_loadu_pd(a + i + 2 * k));
+    }
+
+    double lanes[REDUCTION_LANES];
+    for (int k = 0; k < 4; k++) _mm_storeu_pd(lanes + 2 * k, sum[k]);
+    double result = reduceSum(lanes);
+    for (; i < length; i++) result += a[i];
+    return result;
+}
+
+static double dotSse2(const double* a, const double* b, int length) {
+    __m128d sum[4] = {_mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd()};
+    int i = 0;
+    for (; i + REDUCTION_LANES <= length; i += REDUCTION_LANES) {
+        for (int k = 0; k < 4; k++) {
+            __m128d product = _mm_mul_pd(_mm_loadu_pd(a + i + 2 * k), _mm_loadu_pd(b + i + 2 * k));
+            sum[k] = _mm_add_pd(sum[k], product);
+        }
+    }
+
+    double lanes[REDUCTION_LANES];
+    for (int k = 0; k < 4; k++) _mm_storeu_pd(lanes + 2 * k, sum[k]);
+    double result = reduceSum(lanes);
+    for (; i < length; i++) result += a[i] * b[i];
+    return result;
+}
+
+static double minSse2(const double* a, int length) {
+    __m128d min[4];
+    for (int k = 0; k < 4; k++) min[k] = _mm_set1_pd(a[0]);
+    int i = 0;
+    for (; i + REDUCTION_LANES <= length; i += REDUCTION_LANES) {
+        for (int k = 0; k < 4; k++) min[k] = _mm_min_pd(_mm_loadu_pd(a + i + 2 * k), min[k]);
+    }
+
+    double lanes[REDUCTION_LANES];
+    for (int k = 0; k < 4; k++) _mm_storeu_pd(lanes + 2 * k, min[k]);
+    double result = reduceMin(lanes);
+    for (; i < length; i++) result = minOf(a[i], result);
+    return result;
+}
+
+static double maxSse2(const double* a, int length) {
+    __m128d max[4];
+    for (int k = 0; k < 4; k++) max[k] = _mm_set1_pd(a[0]);
+    int i = 0;
+    for (; i + REDUCTION_LANES <= length; i += REDUCTION_LANES) {
+        for (int k = 0; k < 4; k++) max[k] = _mm_max_pd(_mm_loadu_pd(a + i + 2 * k), max[k]);
+    }
+
+    double lanes[REDUCTION_LANES];
+    for (int k = 0; k < 4; k++) _mm_storeu_pd(lanes + 2 * k, max[k]);
+    double result = reduceMax(lanes);
+    for (; i < length; i++) result = maxOf(a[i], result);
+    return result;
+}
+
+/**
+ * @note AVX2 版．4 要素ずつ演算する．
+ *       積和には FMA 命令を使わず，乗算と加算で2回丸める（スカラー版や Lox の a * b + c と結果を一致させるため）．
+ */
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+AVX2_TARGET static void addAvx2(double* dst, const double* a, const double* b, int length) {
+    int i = 0;
+    for (; i + 4 <= length; i += 4) _mm256_storeu_pd(dst + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    addScalar(dst + i, a + i, b + i, length - i);
+}
+
+AVX2_TARGET static void mulAvx2(double* dst, const double* a, const double* b, int length) {
+    int i = 0;
+    for (; i + 4 <= length; i += 4) _mm256_storeu_pd(dst + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    mulScalar(dst + i, a + i, b + i, length - i);
+}
+
+AVX2_TARGET static void fmaAvx2(double* dst, const double* a, const double* b, const double* c, int length) {
+    int i = 0;
+    for (; i + 4 <= length; i += 4) {
+        __m256d product = _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i));
+        _mm256_storeu_pd(dst + i, _mm256_add_pd(product, _mm256_loadu_pd(c + i)));
+    }
+    fmaScalar(dst + i, a + i, b + i, c + i, length - i);
+}
+
+AVX2_TARGET static void scaleAvx2(double* dst, const double* a, double k, int length) {
+    __m256d factor = _mm256_set1_pd(k);
+    int i = 0;
+    for (; i + 4 <= length; i += 4) _mm256_storeu_pd(dst + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), factor));
+    scaleScalar(dst + i, a + i, k, length - i);
+}
+
+AVX2_TARGET static void offsetAvx2(double* dst, const double* a, double k, int length) {
+    __m256d term = _mm256_set1_pd(k);
+    int i = 0;
+    for (; i + 4 <= length; i += 4) _mm256_storeu_pd(dst + i, _mm256_add_pd(_mm256_loadu_pd(a + i), term));
+    offsetScalar(dst + i, a + i, k, length - i);
+}
+
+AVX2_TARGET static void fillAvx2(double* dst, double value, int length) {
+    __m256d broadcast = _mm256_set1_pd(value);
+    int i = 0;
+    for (; i + 4 <= length; i += 4) _mm256_storeu_pd(dst + i, broadcast);
+    fillScalar(dst + i, value, length - i);
+}
+
+/**
+ * @note 集約は，4 要素のレジスタ2本を累積値 0〜7 に対応させる．ref. 集約の順序
+ */
+AVX2_TARGET static double sumAvx2(const double* a, int length) {
+    __m256d sum0 = _mm256_setzero_pd();
+    __m256d sum1 = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + REDUCTION_LANES <= length; i += REDUCTION_LANES) {
+        sum0 = _mm256_add_pd(sum0, _mm256_loadu_pd(a + i));
+        sum1 = _mm256_add_pd(sum1, _mm256_loadu_pd(a + i + 4));
+    }
+
+    double lanes[REDUCTION_LANES];
+    _mm256_storeu_pd(lanes, sum0);
+    _mm256_storeu_pd(lanes + 4, sum1);
+    double result = reduceSum(lanes);
+    for (; i < length; i++) result += a[i];
+    return result;
+}
+
+AVX2_TARGET static double dotAvx2(const double* a, const double* b, int length) {
+    __m256d sum0 = _mm256_setzero_pd();
+    __m256d sum1 = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + REDUCTION_LANES <= length; i += REDUCTION_LANES) {
+        sum0 = _mm256_add_pd(sum0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        sum1 = _mm256_add_pd(sum1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+    }
+
+    double lanes[REDUCTION_LANES];
+    _mm256_storeu_pd(lanes, sum0);
+    _mm256_storeu_pd(lanes + 4, sum1);
+    double result = reduceSum(lanes);
+    for (; i < length; i++) result += a[i] * b[i];
+    return result;
+}
+
+AVX2_TARGET static double minAvx2(const double* a, int length) {
+    __m256d min0 = _mm256_set1_pd(a[0]);
+    __m256d min1 = min0;
+    int i = 0;
+    for (; i + REDUCTION_LANES <= length; i += REDUCTION_LANES) {
+        min0 = _mm256_min_pd(_mm256_loadu_pd(a + i), min0);
+        min1 = _mm256_min_pd(_mm256_loadu_pd(a + i + 4), min1);
+    }
+
+    double lanes[REDUCTION_LANES];
+    _mm256_storeu_pd(lanes, min0);
+    _mm256_storeu_pd(lanes + 4, min1);
+    double result = reduceMin(lanes);
+    for (; i < length; i++) result = minOf(a[i], result);
+    return result;
+}
+
+AVX2_TARGET static double maxAvx2(const double* a, int length) {
+    __m256d max0 = _mm256_set1_pd(a[0]);
+    __m256d max1 = max0;
+    int i = 0;
+    for (; i + REDUCTION_LANES <= length; i += REDUCTION_LANES) {
+        max0 = _mm256_max_pd(_mm256_loadu_pd(a + i), max0);
+        max1 = _mm256_max_pd(_mm256_loadu_pd(a + i + 4), max1);
+    }
+
+    double lanes[REDUCTION_LANES];
+    _mm256_storeu_pd(lanes, max0);
+    _mm256_storeu_pd(lanes + 4, max1);
+    double result = reduceMax(lanes);
+    for (; i < length; i++) result = maxOf(a[i], result);
+    return result;
+}
+
+#endif
+
+static const Float64Kernels scalarKernels = {
+    addScalar, mulScalar, fmaScalar, scaleScalar, offsetScalar, fillScalar, sumScalar, dotScalar, minScalar, maxScalar,
+};
+
+#ifdef KERNEL_X86
+static const Float64Kernels sse2Kernels = {
+    addSse2, mulSse2, fmaSse2, scaleSse2, offsetSse2, fillSse2, sumSse2, dotSse2, minSse2, maxSse2,
+};
+
+static const Float64Kernels avx2Kernels = {
+    addAvx2, mulAvx2, fmaAvx2, scaleAvx2, offsetAvx2, fillAvx2, sumAvx2, dotAvx2, minAvx2, maxAvx2,
+};
+#endif
+
+Float64Kernels float64Kernels;
+KernelLevel kernelLevel;
+
+void initKernels() {
+    if (!selectKernels(KERNEL_AVX2) && !selectKernels(KERNEL_SSE2)) selectKernels(KERNEL_SCALAR);
+}
+
+bool selectKernels(KernelLevel level) {
+    switch (level) {
+        case KERNEL_SCALAR:
+            float64Kernels = scalarKernels;
+            break;
+#ifdef KERNEL_X86
+        case KERNEL_SSE2:
+            float64Kernels = sse2Kernels;
+            break;
+        case KERNEL_AVX2:
+            __builtin_cpu_init();
+            if (!__builtin_cpu_supports("avx2")) return false;
+            float64Kernels = avx2Kernels;
+            break;
+#endif
+        default:
+            return false;
+    }
+
+    kernelLevel = level;
+    return true;
+}
+
+/**
+ * @note 符号なし整数で演算して，オーバーフローを（未定義動作ではなく）2^32 を法とする巡回にする．
+ */
+#define WRAP(expression) ((int32_t)(uint32_t)(expression))
+
+void int32Add(int32_t* dst, const int32_t* a, const int32_t* b, int length) {
+    for (int i = 0; i < length; i++) dst[i] = WRAP((uint32_t)a[i] + (uint32_t)b[i]);
+}
+
+void int32Mul(int32_t* dst, const int32_t* a, const int32_t* b, int length) {
+    for (int i = 0; i < length; i++) dst[i] = WRAP((uint32_t)a[i] * (uint32_t)b[i]);
+}
+
+void int32Fma(int32_t* dst, const int32_t* a, const int32_t* b, const int32_t* c, int length) {
+    for (int i = 0; i < length; i++) dst[i] = WRAP((uint32_t)a[i] * (uint32_t)b[i] + (uint32_t)c[i]);
+}
+
+void int32Scale(int32_t* dst, const int32_t* a, int32_t k, int length) {
+    for (int i = 0; i < length; i++) dst[i] = WRAP((uint32_t)a[i] * (uint32_t)k);
+}
+
+void int32Offset(int32_t* dst, const int32_t* a, int32_t k, int length) {
+    for (int i = 0; i < length; i++) dst[i] = WRAP((uint32_t)a[i] + (uint32_t)k);
+}
+
+void int32Fill(int32_t* dst, int32_t value, int length) {
+    for (int i = 0; i < length; i++) dst[i] = value;
+}
+
+int64_t int32Sum(const int32_t* a, int length) {
+    int64_t sum = 0;
+    for (int i = 0; i < length; i++) sum += a[i];
+    return sum;
+}
+
+int64_t int32Dot(const int32_t* a, const int32_t* b, int length) {
+    int64_t sum = 0;
+    for (int i = 0; i < length; i++) sum += (int64_t)a[i] * b[i];
+    return sum;
+}
+
+int32_t int32Min(const int32_t* a, int length) {
+    int32_t min = a[0];
+    for (int i = 1; i < length; i++) min = a[i] < min ? a[i] : min;
+    return min;
+}
+
+int32_t int32Max(const int32_t* a, int length) {
+    int32_t max = a[0];
+    for (int i = 1; i < length; i++) max = a[i] > max ? a[i] : max;
+    return max;
+}
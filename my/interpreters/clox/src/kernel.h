@@ -0,0 +1,67 @@
+#ifndef clox_kernel_h
+#define clox_kernel_h
+
+#include "common.h"
+
+/**
+ * @note 型付き配列の一括演算カーネル．ref. 型付き配列
+ *  Float64Array の要素は NaN ボックス化されていない生の double の配列なので，SIMD 命令でまとめて演算できる．
+ *  同じ演算を スカラー／SSE2／AVX2 の3通りで実装しておき，起動時にCPUが対応する最も速いものを関数ポインタの表に選ぶ．
+ *  AVX2 版は関数単位で target 属性を付けてコンパイルするので，ビルドのフラグを変えなくても，対応していないCPUで落ちることはない．
+ *
+ * @note どの版も同じ結果を返す．積和は融合せずに2回丸め，総和や内積などの集約は全ての版で同じ順序で行う．ref. 集約の順序
+ */
+
+typedef enum {
+    KERNEL_SCALAR,
+    KERNEL_SSE2,
+    KERNEL_AVX2,
+} KernelLevel;
+
+/**
+ * Float64Array 向けのカーネルの表．@note 出力先の配列は，入力の配列と同じでもよい（完全に重なるか，全く重ならないかのどちらか）．
+ */
+typedef struct {
+    void (*add)(double* dst, const double* a, const double* b, int length); // dst = a + b
+    void (*mul)(double* dst, const double* a, const double* b, int length); // dst = a * b
+    void (*fma)(double* dst, const double* a, const double* b, const double* c, int length); // dst = a * b + c
+    void (*scale)(double* dst, const double* a, double k, int length); // dst = a * k
+    void (*offset)(double* dst, const double* a, double k, int length); // dst = a + k
+    void (*fill)(double* dst, double value, int length);
+    double (*sum)(const double* a, int length);
+    double (*dot)(const double* a, const double* b, int length);
+    double (*min)(const double* a, int length); // @warning length は 1 以上．
+    double (*max)(const double* a, int length); // @warning length は 1 以上．
+} Float64Kernels;
+
+extern Float64Kernels float64Kernels; // 現在選ばれているカーネル
+extern KernelLevel kernelLevel;
+
+/**
+ * CPUが対応する最も速いカーネルを選ぶ．
+ */
+void initKernels();
+
+/**
+ * 所与の命令セットのカーネルを選ぶ．@note ベンチマークや，スカラー版との結果の比較に使う．
+ *
+ * @return false: CPUがその命令セットに対応していない（選び直さない）．
+ */
+bool selectKernels(KernelLevel level);
+
+/**
+ * @note Int32Array 向けのカーネルは，コンパイラの自動ベクトル化（-O3）に任せる．
+ *       整数の演算は結合的なので，順序を変えても結果は変わらない．@note オーバーフローは 2^32 を法として巡回させる．
+ */
+void int32Add(int32_t* dst, const int32_t* a, const int32_t* b, int length);
+void int32Mul(int32_t* dst, const int32_t* a, const int32_t* b, int length);
+void int32Fma(int32_t* dst, const int32_t* a, const int32_t* b, const int32_t* c, int length);
+void int32Scale(int32_t* dst, const int32_t* a, int32_t k, int length);
+void int32Offset(int32_t* dst, const int32_t* a, int32_t k, int length);
+void int32Fill(int32_t* dst, int32_t value, int length);
+int64_t int32Sum(const int32_t* a, int length);
+int64_t int32Dot(const int32_t* a, const int32_t* b, int length);
+int32_t int32Min(const int32_t* a, int length); // @warning length は 1 以上．
+int32_t int32Max(const int32_t* a, int length); // @warning length は 1 以上．
+
+#endif
@@ -5,6 +5,9 @@
 #include "common.h"
 #include "chunk.h"
 #include "debug.h"
+#include "kernel.h"
+#include "memory.h"
+#include "profile.h"
 #include "vm.h"
 
 static void repl() {
@@ -65,19 +68,176 @@ static void runFile(const char* path) {
     if (result == INTERPRET_RUNTIME_ERROR) exit (70);
 }
 
+static bool printStats = false; // 終了時にGCの統計情報を出力するかどうか．ref. GCテレメトリ
+
+/**
+ * @note エラーで exit() した場合にも出力されるように，atexit() に登録して使う．
+ */
+static void printStatsAtExit() {
+    if (!printStats) return;
+    printStats = false; // 正常終了時に main から呼んだ後，atexit() で二重に出力しないようにする．
+    printGcStats(stderr);
+}
+
+static const char* profilePath = NULL; // 畳み込みスタックの出力先．@note NULL ならプロファイラを使わない．ref. プロファイリング
+static int profileInterval = PROFILE_DEFAULT_INTERVAL;
+
+/**
+ * @note printStatsAtExit と同様に，atexit() に登録して使う（二重に出力しないのは printProfile 側で保証する）．
+ */
+static void printProfileAtExit() {
+    printProfile(stderr);
+}
+
+#ifdef DEBUG_COUNT_OPCODES
+static const char* opcodeCountsPath = NULL; // 命令の実行回数の出力先．@note NULL なら stderr に出力する．ref. 命令の実行回数
+
+/**
+ * @note エラーで exit() した場合にも出力されるように，atexit() に登録して使う．
+ */
+static void writeOpcodeCountsAtExit() {
+    if (opcodeCountsPath == NULL) {
+        writeOpcodeCounts(stderr);
+        return;
+    }
+
+    FILE* file = fopen(opcodeCountsPath, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Could not write opcode counts to \"%s\".\n", opcodeCountsPath);
+        return;
+    }
+    writeOpcodeCounts(file);
+    fclose(file);
+}
+#endif
+
+static void usage() {
+    fprintf(stderr, "Usage: clox [options] [path]\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --gc-threads=N  Number of threads used to mark the heap (1: single-threaded).\n");
+    fprintf(stderr, "  --gc-slice=N    Gray objects traced per incremental GC slice (0: stop-the-world).\n");
+    fprintf(stderr, "  --gc-nursery=N  Kilobytes allocated between minor GCs (0: disable generational GC).\n");
+    fprintf(stderr, "  --gc-compact=N  Fragmentation percentage that triggers heap compaction (0: never compact).\n");
+    fprintf(stderr, "  --gc-overhead=N Target percentage of run time spent in GC (0: grow the heap by a fixed factor).\n");
+    fprintf(stderr, "  --gc-max-heap=N Megabytes the heap should stay under (0: unlimited).\n");
+    fprintf(stderr, "  --gc-stats      Print GC statistics to stderr on exit.\n");
+    fprintf(stderr, "  --heap-limit=N  Megabytes the heap may never exceed; exceeding it is a runtime error (0: unlimited).\n");
+    fprintf(stderr, "  --simd=LEVEL    Typed array kernels to use: scalar, sse2 or avx2 (default: the fastest the CPU supports).\n");
+    fprintf(stderr, "  --profile[=PATH] Sample the Lox call stack; print hot functions and lines to stderr and\n");
+    fprintf(stderr, "                  write folded stacks for flame graphs to PATH (default: clox.folded) on exit.\n");
+    fprintf(stderr, "  --profile-interval=N Microseconds of CPU time between profiler samples (default: %d).\n", PROFILE_DEFAULT_INTERVAL);
+#ifdef DEBUG_COUNT_OPCODES
+    fprintf(stderr, "  --opcode-counts=PATH Write opcode execution counts as JSON to PATH on exit (default: stderr).\n");
+#endif
+    exit(64);
+}
+
+/**
+ * "--name=value" 形式のオプションであれば，value 部分へのポインタを返す．
+ *
+ * @return name に一致しないオプションの場合は NULL
+ */
+static const char* optionValue(const char* arg, const char* name) {
+    size_t length = strlen(name);
+    if (strncmp(arg, name, length) != 0 || arg[length] != '=') return NULL;
+    return arg + length + 1;
+}
+
+static void parseOption(const char* arg) {
+    const char* value;
+
+    if ((value = optionValue(arg, "--gc-threads")) != NULL) {
+        vm.gcThreads = atoi(value);
+    } else if ((value = optionValue(arg, "--gc-slice")) != NULL) {
+        vm.gcSliceBudget = atoi(value);
+    } else if ((value = optionValue(arg, "--gc-nursery")) != NULL) {
+        vm.nurserySize = (size_t)strtoul(value, NULL, 10) * 1024;
+        vm.nextMinorGC = vm.bytesAllocated + vm.nurserySize;
+    } else if ((value = optionValue(arg, "--gc-compact")) != NULL) {
+        vm.gcCompactThreshold = atoi(value);
+    } else if ((value = optionValue(arg, "--gc-overhead")) != NULL) {
+        vm.gcOverheadTarget = atoi(value);
+    } else if ((value = optionValue(arg, "--gc-max-heap")) != NULL) {
+        vm.gcMaxHeap = (size_t)strtoul(value, NULL, 10) * 1024 * 1024;
+        if (vm.gcMaxHeap > 0 && vm.nextGC > vm.gcMaxHeap) vm.nextGC = vm.gcMaxHeap;
+    } else if (strcmp(arg, "--gc-stats") == 0) {
+        printStats = true;
+    } else if ((value = optionValue(arg, "--heap-limit")) != NULL) {
+        vm.heapLimit = (size_t)strtoul(value, NULL, 10) * 1024 * 1024;
+        if (vm.heapLimit > 0 && vm.nextGC > vm.heapLimit) vm.nextGC = vm.heapLimit;
+    } else if ((value = optionValue(arg, "--simd")) != NULL) {
+        KernelLevel level = KERNEL_SCALAR;
+        if (strcmp(value, "scalar") == 0) {
+            level = KERNEL_SCALAR;
+        } else if (strcmp(value, "sse2") == 0) {
+            level = KERNEL_SSE2;
+        } else if (strcmp(value, "avx2") == 0) {
+            level = KERNEL_AVX2;
+        } else {
+            fprintf(stderr, "Unknown SIMD level \"%s\".\n", value);
+            usage();
+        }
+        if (!selectKernels(level)) {
+            fprintf(stderr, "This CPU does not support \"%s\".\n", value);
+            exit(64);
+        }
+    } else if (strcmp(arg, "--profile") == 0) {
+        profilePath = "clox.folded";
+    } else if ((value = optionValue(arg, "--profile")) != NULL) {
+        profilePath = value;
+    } else if ((value = optionValue(arg, "--profile-interval")) != NULL) {
+        profileInterval = atoi(value);
+        if (profileInterval <= 0) {
+            fprintf(stderr, "Profile interval must be positive.\n");
+            usage();
+        }
+#ifdef DEBUG_COUNT_OPCODES
+    } else if ((value = optionValue(arg, "--opcode-counts")) != NULL) {
+        opcodeCountsPath = value;
+#endif
+    } else {
+        fprintf(stderr, "Unknown option \"%s\".\n", arg);
+        usage();
+    }
+}
+
 int main(int argc, const char* argv[]) {
     initVM();
 
     // WARNING: argv の第一引数は常に実行ファイル名になる．
-    if (argc == 1) {
+    const char* path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) == 0) {
+            parseOption(argv[i]);
+        } else if (path == NULL) {
+            path = argv[i];
+        } else {
+            usage();
+        }
+    }
+
+    atexit(printStatsAtExit);
+#ifdef DEBUG_COUNT_OPCODES
+    atexit(writeOpcodeCountsAtExit);
+#endif
+
+    // @note 関数はコンパイル時にプロファイラへ登録されるので，コンパイルより前に開始する．
+    if (profilePath != NULL) {
+        if (!startProfiler(profilePath, profileInterval)) {
+            fprintf(stderr, "Could not start the profiler.\n");
+            exit(64);
+        }
+        atexit(printProfileAtExit);
+    }
+
+    if (path == NULL) {
         repl();
-    } else if (argc == 2) {
-        runFile(argv[1]);
     } else {
-        fprintf(stderr, "Usage: clox [path]\n");
-        exit(64);
+        runFile(path);
     }
 
+    printProfile(stderr);
+    printStatsAtExit(); // @note freeVM() で全てのオブジェクトが解放される前に出力する．
     freeVM();
     return 0;
 }
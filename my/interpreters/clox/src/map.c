@@ -0,0 +1,213 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "map.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+
+#define MAP_MAX_LOAD 0.75 // ハッシュ表の最大許容占有率（衝突を避けるために 1 未満で調整する）
+
+void initMap(Map* map) {
+    map->count = 0;
+    map->liveCount = 0;
+    map->capacity = 0;
+    map->entries = NULL;
+}
+
+void freeMap(Map* map) {
+    FREE_ARRAY(MapEntry, map->entries, map->capacity);
+    initMap(map);
+}
+
+bool mapKey(Value* key, bool intern) {
+    if (IS_NIL(*key)) return false;
+
+    if (IS_NUMBER(*key)) {
+        double number = AS_NUMBER(*key);
+        if (number != number) return false; // NaN は自身とも等しくないので，キーにしても二度と取り出せない．
+        if (number == 0) *key = NUMBER_VAL(0); // -0 と 0 は == で等しいので，同じキーとして扱う．
+        return true;
+    }
+
+    if (!isStringLike(*key)) return true;
+
+    ObjString* string = asString(*key);
+    if (!string->obj.isInterned) {
+        if (intern) {
+            string = internString(string);
+        } else {
+            // @note インターン化済みの同じ文字列が無ければ，その文字列をキーに持つエントリも無い．
+            ObjString* interned = tableFindString(
+                &vm.strings, string->chars, string->length, hashString(string->chars, string->length)
+            );
+            if (interned != NULL) string = interned;
+        }
+    }
+    *key = OBJ_VAL(string);
+    return true;
+}
+
+/**
+ * @warning key は正規化済みであること．
+ */
+static uint32_t hashKey(Value key) {
+    if (IS_OBJ(key)) {
+        Obj* object = AS_OBJ(key);
+        if (object->type == OBJ_STRING) return ((ObjString*)object)->hash; // インターン化済みなのでハッシュ値は計算済み．
+        return hashBits((uint64_t)(uintptr_t)object);
+    }
+    if (IS_NUMBER(key)) {
+        double number = AS_NUMBER(key);
+        uint64_t bits;
+        memcpy(&bits, &number, sizeof(bits));
+        return hashBits(bits);
+    }
+    return AS_BOOL(key) ? 1 : 0;
+}
+
+/**
+ * @note 正規化済みのキー同士は，同じ値ならビット表現も一致する．
+ */
+static inline bool keysEqual(Value a, Value b) {
+#ifdef NAN_BOXING
+    return a == b;
+#else
+    if (a.type != b.type) return false;
+
+    switch (a.type) {
+        case VAL_BOOL: return AS_BOOL(a) == AS_BOOL(b);
+        case VAL_NIL: return true;
+        case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
+        case VAL_OBJ: return AS_OBJ(a) == AS_OBJ(b);
+        default: return false;
+    }
+#endif
+}
+
+/**
+ * @note そのエントリが空だったとしてもそれをそのまま返す（空ということは，その場所に新しいエントリを記入できることを示す）．
+ *       墓標を通過していたら，最初の墓標を返して再利用する．ref. Table の findEntry
+ */
+static MapEntry* findEntry(MapEntry* entries, int capacity, Value key) {
+    uint32_t index = hashKey(key) & (capacity - 1);
+    MapEntry* tombstone = NULL;
+
+    for (;;) {
+        MapEntry* entry = &entries[index];
+
+        if (IS_NIL(entry->key)) {
+            if (IS_NIL(entry->value)) return tombstone != NULL ? tombstone : entry;
+            if (tombstone == NULL) tombstone = entry;
+        } else if (keysEqual(entry->key, key)) {
+            return entry;
+        }
+
+        index = (index + 1) & (capacity - 1); // 線形探針
+    }
+}
+
+bool mapGet(Map* map, Value key, Value* value) {
+    if (map->count == 0) return false;
+    if (IS_STRING(key) && !AS_OBJ(key)->isInterned) return false; // 文字列のキーは全てインターン化済み．
+
+    MapEntry* entry = findEntry(map->entries, map->capacity, key);
+    if (IS_NIL(entry->key)) return false;
+
+    *value = entry->value;
+    return true;
+}
+
+/**
+ * @note 墓標エントリはコピーしても意味がないので，コピーしない．
+ */
+static void adjustCapacity(Map* map, int capacity) {
+    MapEntry* entries = ALLOCATE(MapEntry, capacity);
+    for (int i = 0; i < capacity; i++) {
+        entries[i].key = NIL_VAL;
+        entries[i].value = NIL_VAL;
+    }
+
+    map->count = 0;
+    for (int i = 0; i < map->capacity; i++) {
+        MapEntry* entry = &map->entries[i];
+        if (IS_NIL(entry->key)) continue;
+
+        MapEntry* dest = findEntry(entries, capacity, entry->key);
+        dest->key = entry->key;
+        dest->value = entry->value;
+        map->count++;
+    }
+
+    FREE_ARRAY(MapEntry, map->entries, map->capacity);
+    map->entries = entries;
+    map->capacity = capacity;
+}
+
+bool mapSet(Map* map, Value key, Value value) {
+    if (map->count + 1 > map->capacity * MAP_MAX_LOAD) {
+        adjustCapacity(map, GROW_CAPACITY(map->capacity));
+    }
+
+    MapEntry* entry = findEntry(map->entries, map->capacity, key);
+    bool isNewKey = IS_NIL(entry->key);
+
+    // NOTE: 墓標エントリの場合は，既にカウント済みなのでインクリメントしない．
+    if (isNewKey && IS_NIL(entry->value)) map->count++;
+    if (isNewKey) map->liveCount++;
+
+    entry->key = key;
+    entry->value = value;
+    return isNewKey;
+}
+
+bool mapDelete(Map* map, Value key) {
+    if (map->count == 0) return false;
+    if (IS_STRING(key) && !AS_OBJ(key)->isInterned) return false;
+
+    MapEntry* entry = findEntry(map->entries, map->capacity, key);
+    if (IS_NIL(entry->key)) return false;
+
+    // 墓標を置く．
+    entry->key = NIL_VAL;
+    entry->value = BOOL_VAL(true);
+    map->liveCount--;
+    return true;
+}
+
+void mapRehash(Map* map) {
+    int live = 0;
+    for (int i = 0; i < map->capacity; i++) {
+        if (!IS_NIL(map->entries[i].key)) live++;
+    }
+
+    // @note 退避先はGCの管理外のメモリにする（GCの途中で呼ばれるので，reallocate は使えない）．
+    MapEntry* scratch = (MapEntry*)malloc(sizeof(MapEntry) * (live > 0 ? live : 1));
+    if (scratch == NULL) exit(1); // アロケーションの失敗．
+
+    int count = 0;
+    for (int i = 0; i < map->capacity; i++) {
+        MapEntry* entry = &map->entries[i];
+        if (!IS_NIL(entry->key)) scratch[count++] = *entry;
+        entry->key = NIL_VAL;
+        entry->value = NIL_VAL;
+    }
+
+    map->count = 0;
+    for (int i = 0; i < count; i++) {
+        MapEntry* dest = findEntry(map->entries, map->capacity, scratch[i].key);
+        *dest = scratch[i];
+        map->count++;
+    }
+    free(scratch);
+}
+
+void markMap(Map* map) {
+    for (int i = 0; i < map->capacity; i++) {
+        MapEntry* entry = &map->entries[i];
+        markValue(entry->key);
+        markValue(entry->value);
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef clox_map_h
+#define clox_map_h
+
+#include "common.h"
+#include "value.h"
+
+/**
+ * @note 任意の値をキーに取るハッシュ表．ref. マップ
+ *  Table はキーが文字列（インターン化済みの ObjString）に限られるので，Lox のマップ型のためにキーを Value に広げたもの．
+ *  キーは以下のように正規化してから表に入れるので，比較はビット表現（ポインタ）の一致だけで済む．
+ *   - 文字列: ロープは平坦化し，インターン化する．@note 内容が同じ文字列は，同じ ObjString になる．
+ *   - 数値: -0 は 0 にそろえる．
+ *  文字列以外のオブジェクトはアドレスでハッシュするので，コンパクションでキーが移動したら mapRehash で並べ直す．
+ */
+
+/**
+ * ハッシュ表の要素
+ * キーと値のペア
+ */
+typedef struct {
+    Value key; // @note 空きスロットのキーは nil（値も nil），墓標のキーは nil（値は true）．そのため nil はキーにできない．
+    Value value;
+} MapEntry;
+
+/**
+ * @note count / capacity = ハッシュ表の占有率
+ */
+typedef struct {
+    int count; // 要素数（利用済みの容量）＋墓標数
+    int liveCount; // 墓標を除いた要素数．@note Lox から見たマップの大きさ．
+    int capacity; // 総容量
+    MapEntry* entries; // エントリの配列の先頭要素へのポインタ
+} Map;
+
+void initMap(Map* map);
+void freeMap(Map* map);
+
+/**
+ * キーを正規化する．
+ *
+ * @param intern true: まだインターン化されていない文字列をインターン化する（割り当てが発生しうる）．
+ *               false: インターン化済みの同じ文字列があればそれに置き換えるだけで，割り当ては（ロープの平坦化以外）発生しない．
+ * @return true: キーにできる値, false: キーにできない値（nil か NaN）
+ * @warning key は，GCから到達可能な状態で渡すこと．
+ */
+bool mapKey(Value* key, bool intern);
+
+/**
+ * @param key mapKey で正規化済みのキー
+ * @param value 出力パラメータ．キーに一致するエントリの値がコピーされる．
+ * @return true: キーを持つエントリが存在した, false: 存在しなかった
+ */
+bool mapGet(Map* map, Value key, Value* value);
+
+/**
+ * @param key mapKey（intern = true）で正規化済みのキー
+ * @return true: 新規エントリーの追加, false: 既存のエントリーの上書き
+ */
+bool mapSet(Map* map, Value key, Value value);
+
+/**
+ * @param key mapKey で正規化済みのキー
+ * @return true: キーを持つエントリを削除した, false: 存在しなかった
+ */
+bool mapDelete(Map* map, Value key);
+
+/**
+ * 全てのエントリを並べ直す．@note アドレスでハッシュしたキーが移動した後に呼ぶ．GCの管理外のメモリしか使わないので，GCの途中でも呼べる．
+ */
+void mapRehash(Map* map);
+
+void markMap(Map* map);
+
+#endif
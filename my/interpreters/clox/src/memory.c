@@ -1,7 +1,15 @@
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "compiler.h"
 #include "memory.h"
+#include "pool.h"
+#include "profile.h"
 #include "vm.h"
 
 #ifdef DEBUG_LOG_GC
@@ -9,38 +17,241 @@
 #include "debug.h"
 #endif
 
-#define GC_HEAP_GROW_FACTOR 2 // 次のGCの閾値を現在の使用しているヒープメモリサイズの何倍に設定するか．
+#define GC_HEAP_GROW_FACTOR 2 // 次のGCの閾値を現在の使用しているヒープメモリサイズの何倍に設定するか．@note 適応的なヒープサイズ調整を無効にした場合と，生存率が高い場合の下限に使う．
+#define GC_MIN_GROW_FACTOR 1.25 // 適応的なヒープサイズ調整で，閾値を生きているオブジェクトの何倍以上にするか．@note 回収できる量が少なすぎるGCを繰り返さないようにする．
+#define GC_MAX_GROW_FACTOR 8 // 適応的なヒープサイズ調整で，閾値を生きているオブジェクトの何倍までにするか．
+#define GC_HIGH_SURVIVAL 0.9 // 生存率がこれ以上のサイクルは，ほとんど回収できていないので，閾値を少なくとも GC_HEAP_GROW_FACTOR 倍にする．
+#define GC_POLICY_SMOOTHING 0.5 // 実測値の指数移動平均で，最新のサイクルの値に掛ける重み．@note 1回のサイクルの揺らぎで閾値が暴れないようにする．
+#define GC_PARALLEL_MIN_HEAP (4 * 1024 * 1024) // 並列マーキングに切り替えるヒープサイズの下限．@note これより小さいヒープでは，スレッドの起動・同期コストの方が大きくなる．
+#define GC_STEP_SIZE (64 * 1024) // インクリメンタルマーキング中に，何バイト割り当てるごとにマーキングを1スライス進めるか．
+#define GC_SWEEP_BATCH 32 // 遅延スイープで，1回の割り当てごとに処理するオブジェクトの数．
+#define GC_PUBLISH_THRESHOLD 64 // 自分専用のグレースタックがこの個数を超えたら，半分を他のスレッドが盗める共有スタックに公開する．
+#define GC_COMPACT_MIN_HEAP (1024 * 1024) // コンパクションを検討するオブジェクトプールの大きさの下限．@note 小さなヒープでは，断片化していても大した無駄にならない．
 
-void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
+/**
+ * 並列マーキング用のワーカー（1スレッドにつき1つ）
+ *
+ * @note ワークスティーリング
+ *  各スレッドは自分専用のグレースタック（items）をロックなしで消費する．
+ *  仕事が溜まってきたら，その一部を共有スタック（shared）に移して公開し，
+ *  手の空いたスレッドは他のスレッドの共有スタックから仕事を盗む．
+ */
+typedef struct {
+    Obj** items; // 自分専用のグレースタック．@note 持ち主のスレッドしか触らないので，ロック不要．
+    int count;
+    int capacity;
+
+    pthread_mutex_t lock; // 共有スタックを保護するロック
+    Obj** shared; // 他のスレッドが盗める共有グレースタック
+    int sharedCount;
+    int sharedCapacity;
+
+    pthread_t thread;
+    bool started; // スレッドの起動に成功したかどうか
+} MarkWorker;
+
+static MarkWorker workers[GC_MAX_MARK_THREADS];
+static bool workersInitialized = false; // ワーカーのロックを初期化済みかどうか
+static int workerCount = 0; // 今回のマーキングに参加するワーカーの数
+static int idleWorkers = 0; // 仕事が見つからず待機中のワーカーの数．@warning アトミックに読み書きする．
+static int sharedTotal = 0; // 全ワーカーの共有スタックに残っているオブジェクトの総数．@warning アトミックに読み書きする．
+
+/**
+ * このスレッドが担当しているワーカー．@note NULL の場合は，シングルスレッドでマーキングしている．
+ */
+static _Thread_local MarkWorker* currentWorker = NULL;
+
+GcStats gcStats;
+
+static int pauseDepth = 0; // 入れ子になった停止の深さ．@note collectGarbage() が beginCycle() を呼ぶように停止が入れ子になっても，一番外側だけを1回の停止として数える．
+static uint64_t pauseStart; // 一番外側の停止の開始時刻
+
+static uint64_t lazySweepNanos = 0; // 停止の外（割り当てのついで）で行った遅延スイープの累計時間．ref. 遅延スイープ
+
+/**
+ * 適応的なヒープサイズ調整のために，前回のサイクルの終了時点で記録しておく値．ref. 適応的なヒープサイズ調整
+ */
+static uint64_t lastCycleEndNanos = 0; // 前回のサイクルの終了時刻．@note 0 の場合は起動時刻から数える．
+static uint64_t lastGcNanos = 0; // 前回のサイクルの終了時点での，GCに使った累計時間
+static uint64_t lastMajorNanos = 0; // 前回のサイクルの終了時点での，メジャーGCに使った累計時間
+static size_t lastTotalAllocated = 0; // 前回のサイクルの終了時点での，累計割り当てバイト数
+static size_t sweptBytes = 0; // 今回のサイクルのスイープで解放したバイト数（生存率の計算に使う）
+static double averageCycleSeconds = 0; // メジャーGCサイクル1回あたりの時間（指数移動平均）
+static double averageAllocationRate = 0; // ミューテータの割り当て速度（バイト／秒，指数移動平均）
+
+static bool sweeping = false; // 遅延スイープの途中かどうか．ref. 遅延スイープ
+static Obj* sweepPrevious = NULL; // 遅延スイープで最後に生き残りと判定したオブジェクト．@note NULL の場合は，未スイープのチェーンの先頭から調べる．
+
+static uint64_t nowNanos() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000u + (uint64_t)time.tv_nsec;
+}
+
+/**
+ * ミューテータを止めるGCの処理の開始時に呼ぶ．ref. GCテレメトリ
+ */
+static void beginPause() {
+    if (pauseDepth++ == 0) {
+        pauseStart = nowNanos();
+        profilePhase = PROFILE_GC;
+    }
+}
+
+/**
+ * ミューテータを止めるGCの処理の終了時に呼び，停止時間を集計する．ref. GCテレメトリ
+ */
+static void endPause() {
+    if (--pauseDepth > 0) return;
+    profilePhase = PROFILE_MUTATOR;
+
+    uint64_t nanos = nowNanos() - pauseStart;
+    gcStats.pauseCount++;
+    gcStats.pauseNanos += nanos;
+    if (nanos > gcStats.pauseMaxNanos) gcStats.pauseMaxNanos = nanos;
+
+    // 停止時間（マイクロ秒）のビット長をバケットの番号にする．
+    int bucket = 0;
+    for (uint64_t micros = nanos / 1000; micros > 0 && bucket < GC_PAUSE_BUCKETS - 1; micros >>= 1) {
+        bucket++;
+    }
+    gcStats.pauseHistogram[bucket]++;
+}
+
+static void beginCycle();
+static void finishSweep();
+static void stepGarbage();
+static void collectYoung();
+static void sweepSome(int budget);
+
+/**
+ * 緊急のフルGC：進行中のサイクルと遅延スイープも含めて，回収できるものを今すぐ全て回収する．ref. ヒープの上限
+ *
+ * @param needed これから割り当てようとしているバイト数（vm.bytesAllocated に計上済み）
+ * @note オブジェクトを移動するコンパクションは，セーフポイントでしか行えないので，次のセーフポイントに予約するだけにする．
+ */
+static void collectForSpace(size_t needed) {
+#ifdef DEBUG_LOG_GC
+    printf("-- emergency gc (%zu bytes requested)\n", needed);
+#else
+    (void)needed; // ログ出力にしか使わない．
+#endif
+
+    collectGarbage();
+    finishSweep();
+    if (vm.gcCompactThreshold > 0) vm.gcCompactPending = true;
+}
+
+/**
+ * 割り当てを諦めて，interpret() まで戻る．ref. ヒープの上限
+ *
+ * @param needed 割り当てようとしていたバイト数（vm.bytesAllocated に計上済みなので，ここで差し戻す）
+ * @param limitExceeded true: ヒープサイズの上限を超えた．false: システムの割り当てに失敗した．
+ */
+static void outOfMemory(size_t needed, bool limitExceeded) {
+    vm.bytesAllocated -= needed;
+    vm.heapLimitExceeded = limitExceeded;
+
+    if (vm.outOfMemoryHandler == NULL) {
+        // 戻り先がない（VMの初期化中など）場合は，これまで通りプロセスを終了する．
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+    longjmp(*vm.outOfMemoryHandler, 1);
+}
+
+static void* reallocateFrom(PoolKind kind, void* pointer, size_t oldSize, size_t newSize) {
     vm.bytesAllocated += newSize - oldSize;
 
     if (newSize > oldSize) {
+        // ref. GCテレメトリ
+        gcStats.totalAllocated += newSize - oldSize;
+        if (vm.bytesAllocated > gcStats.peakHeap) gcStats.peakHeap = vm.bytesAllocated;
+
 #ifdef DEBUG_STRESS_GC
         collectGarbage();
 #endif
 
-        // ref. 自己調整ヒープ
-        if (vm.bytesAllocated > vm.nextGC) {
-            collectGarbage();
+        // ref. 遅延スイープ
+        if (sweeping) sweepSome(GC_SWEEP_BATCH);
+
+        if (vm.gcMarking) {
+            // ref. インクリメンタルGC
+            if (vm.bytesAllocated > vm.nextGCStep) {
+                stepGarbage();
+            }
+        } else if (vm.bytesAllocated > vm.nextGC) {
+            // ref. 自己調整ヒープ
+            if (vm.gcSliceBudget > 0) {
+                beginCycle();
+            } else {
+                collectGarbage();
+            }
+        } else if (vm.nurserySize > 0 && vm.bytesAllocated > vm.nextMinorGC) {
+            // ref. 世代別GC
+            collectYoung();
         }
-    }
 
-    if (newSize == 0) {
-        free(pointer);
-        return NULL;
+        // ref. ヒープの上限
+        if (vm.heapLimit > 0 && vm.bytesAllocated > vm.heapLimit) {
+            collectForSpace(newSize - oldSize);
+            if (vm.bytesAllocated > vm.heapLimit) outOfMemory(newSize - oldSize, true);
+        }
     }
 
-    // NOTE: pointer には，そのポインタが指すメモリブロックのサイズをメタデータとして持っている．
-    void* result = realloc(pointer, newSize);
+    // NOTE: 小さな割り当てはサイズクラス別のプールから，大きな割り当てはシステムの realloc から行う．ref. サイズクラス別のプールアロケータ
+    void* result = poolReallocate(kind, pointer, oldSize, newSize);
 
-    if (result == NULL) exit(1);
+    if (newSize == 0) return NULL;
+    if (result == NULL) {
+        // システムのメモリが足りない場合も，ゴミを回収してから一度だけやり直す．
+        collectForSpace(newSize - oldSize);
+        result = poolReallocate(kind, pointer, oldSize, newSize);
+        if (result == NULL) outOfMemory(newSize - oldSize, false);
+    }
 
     return result;
 }
 
+void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
+    return reallocateFrom(POOL_ARRAY, pointer, oldSize, newSize);
+}
+
+void* reallocateObject(void* pointer, size_t oldSize, size_t newSize) {
+    return reallocateFrom(POOL_OBJECT, pointer, oldSize, newSize);
+}
+
+/**
+ * @param capacity 現在の総容量．必要に応じて拡張された値で上書きされる．
+ * @warning GCの再帰的な起動を避けるため，reallocate ではなく，システムの realloc を直接呼び出す．
+ */
+static Obj** growGrayArray(Obj** array, int* capacity, int needed) {
+    if (*capacity >= needed) return array;
+
+    while (*capacity < needed) *capacity = GROW_CAPACITY(*capacity);
+    array = (Obj**)realloc(array, sizeof(Obj*) * *capacity);
+
+    if (array == NULL) exit(1); // アロケーションの失敗．
+    return array;
+}
+
+static void pushWorker(MarkWorker* worker, Obj* object) {
+    worker->items = growGrayArray(worker->items, &worker->capacity, worker->count + 1);
+    worker->items[worker->count++] = object;
+}
+
 void markObject(Obj* object) {
     if (object == NULL) return;
-    if (object->isMarked) return; // オブジェクト参照が閉路になっている場合の無限ループを防ぐ．
+    if (vm.gcMinor && !object->isYoung) return; // マイナーGCでは古いオブジェクトを辿らない．
+
+    if (currentWorker != NULL) {
+        // 並列マーキング中は，複数のスレッドが同じオブジェクトに同時に到達しうるので，アトミックにマークする．
+        if (poolMark(object, true)) return;
+        pushWorker(currentWorker, object);
+        return;
+    }
+
+    if (poolIsMarked(object)) return; // オブジェクト参照が閉路になっている場合の無限ループを防ぐ．
 
 #ifdef DEBUG_LOG_GC
     printf("%p mark ", (void*)object);
@@ -48,7 +259,7 @@ void markObject(Obj* object) {
     printf("\n");
 #endif
 
-    object->isMarked = true;
+    poolMark(object, false);
 
     // ref. 三色抽象化
     if (vm.grayCapacity < vm.grayCount + 1) {
@@ -70,6 +281,30 @@ void markValue(Value value) {
     if (IS_OBJ(value)) markObject(AS_OBJ(value));
 }
 
+void rememberObject(Obj* object) {
+    object->isRemembered = true;
+
+    if (vm.rememberedCapacity < vm.rememberedCount + 1) {
+        vm.rememberedCapacity = GROW_CAPACITY(vm.rememberedCapacity);
+        // WARNING: 書き込みバリアの途中でGCを起動させないように，システムの realloc を直接呼び出す．
+        vm.remembered = (Obj**)realloc(vm.remembered, sizeof(Obj*) * vm.rememberedCapacity);
+        if (vm.remembered == NULL) exit(1); // アロケーションの失敗．
+    }
+
+    vm.remembered[vm.rememberedCount++] = object;
+}
+
+void rememberYoungString(ObjString* string) {
+    if (vm.youngStringCapacity < vm.youngStringCount + 1) {
+        vm.youngStringCapacity = GROW_CAPACITY(vm.youngStringCapacity);
+        // WARNING: 文字列表に登録した直後の文字列はどこからも到達できないので，GCを起動させないように，システムの realloc を直接呼び出す．
+        vm.youngStrings = (ObjString**)realloc(vm.youngStrings, sizeof(ObjString*) * vm.youngStringCapacity);
+        if (vm.youngStrings == NULL) exit(1); // アロケーションの失敗．
+    }
+
+    vm.youngStrings[vm.youngStringCount++] = string;
+}
+
 static void markArray(ValueArray* array) {
     for (int i = 0; i < array->count; i++) {
         markValue(array->values[i]);
@@ -80,7 +315,7 @@ static void markArray(ValueArray* array) {
  * 所与のオブジェクトの参照を辿って暗黒化（blacken）する．
  *
  * @note 暗黒化：白オブジェクトをグレーに，グレーオブジェクトを黒に変える．ref. 三色抽象化
- * @note 黒オブジェクト：isMarked が true の状態で，グレースタックから外れたオブジェクトのこと．
+ * @note 黒オブジェクト：マークビットが立った状態で，グレースタックから外れたオブジェクトのこと．
  */
 static void blackenObject(Obj* object) {
 #ifdef DEBUG_LOG_GC
@@ -101,6 +336,13 @@ static void blackenObject(Obj* object) {
             ObjClass* klass = (ObjClass*)object;
             markObject((Obj*)klass->name);
             markTable(&klass->methods);
+            for (int i = 0; i < klass->vtableCount; i++) {
+                markObject((Obj*)klass->vtable[i]);
+            }
+            for (int i = 0; i < klass->sparseCapacity; i++) {
+                markObject((Obj*)klass->sparseMethods[i].method);
+            }
+            markObject((Obj*)klass->initializer);
             break;
         }
         case OBJ_CLOSURE: {
@@ -123,6 +365,19 @@ static void blackenObject(Obj* object) {
             markTable(&instance->fields);
             break;
         }
+        case OBJ_LIST:
+            markArray(&((ObjList*)object)->items);
+            break;
+        case OBJ_MAP:
+            markMap(&((ObjMap*)object)->table);
+            break;
+        case OBJ_ROPE: {
+            ObjRope* rope = (ObjRope*)object;
+            markObject(rope->left);
+            markObject(rope->right);
+            markObject((Obj*)rope->flat);
+            break;
+        }
         case OBJ_UPVALUE:
             markValue(((ObjUpvalue*)object)->closed);
             break;
@@ -130,6 +385,7 @@ static void blackenObject(Obj* object) {
         // オブジェクト参照を含まないので，さらに辿るべきものがないタイプ
         case OBJ_NATIVE:
         case OBJ_STRING:
+        case OBJ_TYPED_ARRAY:
             break;
     }
 }
@@ -139,6 +395,8 @@ static void freeObject(Obj* object) {
     printf("%p free type %d\n", (void*)object, object->type);
 #endif
 
+    gcStats.liveObjects[object->type]--; // ref. GCテレメトリ
+
     switch (object->type) {
         case OBJ_BOUND_METHOD:
             FREE(ObjBoundMethod, object);
@@ -146,15 +404,15 @@ static void freeObject(Obj* object) {
         case OBJ_CLASS: {
             ObjClass* klass = (ObjClass*)object;
             freeTable(&klass->methods);
+            FREE_ARRAY(ObjClosure*, klass->vtable, klass->vtableCount);
+            FREE_ARRAY(MethodEntry, klass->sparseMethods, klass->sparseCapacity);
             FREE(ObjClass, object);
             break;
         }
         case OBJ_CLOSURE: {
             ObjClosure* closure = (ObjClosure*)object;
-            // NOTE: ObjUpvalue そのものは所有しないが，上位値へのポインタを含む配列は所有するので，ここで解放する．
-            FREE_ARRAY(ObjUpvalue*, closure->upvalues, closure->upvalueCount);
-            // NOTE: ObjFunction は所有していないので解放もしない．
-            FREE(ObjClosure, object);
+            // NOTE: ObjUpvalue や ObjFunction は所有していないので解放もしない．上位値へのポインタの配列はオブジェクトと一緒に解放される．
+            FREE_FLEX(ObjClosure, ObjUpvalue*, object, closure->upvalueCount);
             break;
         }
         case OBJ_FUNCTION: {
@@ -169,11 +427,25 @@ static void freeObject(Obj* object) {
             FREE(ObjInstance, object);
             break;
         }
+        case OBJ_LIST:
+            freeValueArray(&((ObjList*)object)->items); // 要素そのものの解放はGCに任せる．
+            FREE(ObjList, object);
+            break;
+        case OBJ_MAP:
+            freeMap(&((ObjMap*)object)->table); // キーと値そのものの解放はGCに任せる．
+            FREE(ObjMap, object);
+            break;
         case OBJ_NATIVE: FREE(ObjNative, object); break;
+        case OBJ_ROPE: FREE(ObjRope, object); break;
         case OBJ_STRING: {
             ObjString* string = (ObjString*)object;
-            FREE_ARRAY(char, string->chars, string->length + 1);
-            FREE(ObjString, object);
+            FREE_FLEX(ObjString, char, object, string->length + 1);
+            break;
+        }
+        case OBJ_TYPED_ARRAY: {
+            ObjTypedArray* array = (ObjTypedArray*)object;
+            reallocate(array->data, typedArrayElementSize(array->kind) * array->length, 0);
+            FREE(ObjTypedArray, object);
             break;
         }
         case OBJ_UPVALUE: FREE(ObjUpvalue, object); break;
@@ -181,11 +453,12 @@ static void freeObject(Obj* object) {
 }
 
 /**
- * 直接参照可能なルートオブジェクトを走査し，マーキングとグレースタックへの追加を行う．
+ * 書き込みバリアで監視されていないルートオブジェクトを走査し，マーキングとグレースタックへの追加を行う．
  *
- * ref. 三色抽象化
+ * @note インクリメンタルGCでは，マーキング中もミューテータがこれらのルートを書き換えるので，
+ *       サイクルの最後に改めて走査し直す（再マーク）．
  */
-static void markRoots() {
+static void markStackRoots() {
     // スタック上の値（ローカル変数，一時的な値）
     for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
         markValue(*slot);
@@ -205,89 +478,982 @@ static void markRoots() {
         markObject((Obj*)upvalue);
     }
 
-    // グローバル変数のハッシュ表
-    markTable(&vm.globals);
-
     // コンパイラが直接アクセスする値
     markCompilerRoots();
 
     // 消えたら困るので，ルート扱いにして常にマークされた状態にする．
     markObject((Obj*)vm.initString);
+    markArray(&vm.methodNames); // @note メソッド名が回収されて作り直されると，スロット番号が失われるので，生かしておく．
+}
+
+/**
+ * 直接参照可能なルートオブジェクトを走査し，マーキングとグレースタックへの追加を行う．
+ *
+ * ref. 三色抽象化
+ */
+static void markRoots() {
+    markStackRoots();
+
+    // グローバル変数のハッシュ表．@note 書き込みは全て書き込みバリアを通るので，再マークは不要．
+    markTable(&vm.globals);
+}
+
+static void traceReferencesSerial() {
+    while (vm.grayCount > 0) {
+        Obj* object = vm.grayStack[--vm.grayCount]; // note: 後置デクリメント：先にデクリメントしてから，その新しい値をインデックスに使う．
+        blackenObject(object);
+    }
+}
+
+/**
+ * 自分専用のグレースタックの下半分（＝古く，より大きな部分グラフの根である可能性が高いもの）を共有スタックに移す．
+ */
+static void publishWork(MarkWorker* worker) {
+    int half = worker->count / 2;
+
+    pthread_mutex_lock(&worker->lock);
+    worker->shared = growGrayArray(worker->shared, &worker->sharedCapacity, worker->sharedCount + half);
+    memcpy(worker->shared + worker->sharedCount, worker->items, sizeof(Obj*) * half);
+    __atomic_store_n(&worker->sharedCount, worker->sharedCount + half, __ATOMIC_RELAXED); // 他のスレッドがロックなしで覗き見るので，アトミックに書き込む．
+    __atomic_add_fetch(&sharedTotal, half, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&worker->lock);
+
+    memmove(worker->items, worker->items + half, sizeof(Obj*) * (worker->count - half));
+    worker->count -= half;
+}
+
+/**
+ * 自分，または他のワーカーの共有スタックから仕事を取ってくる．
+ *
+ * @return true: 仕事を取ってこれた．false: どこにも仕事が無かった．
+ */
+static bool takeWork(MarkWorker* self) {
+    int selfIndex = (int)(self - workers);
+
+    for (int i = 0; i < workerCount; i++) {
+        MarkWorker* victim = &workers[(selfIndex + i) % workerCount];
+        if (__atomic_load_n(&victim->sharedCount, __ATOMIC_RELAXED) == 0) continue;
+
+        pthread_mutex_lock(&victim->lock);
+        // 自分の共有スタックなら全部，他人のものなら半分（最低1個）を盗む．
+        int take = victim == self ? victim->sharedCount : (victim->sharedCount + 1) / 2;
+        if (take > 0) {
+            self->items = growGrayArray(self->items, &self->capacity, self->count + take);
+            __atomic_store_n(&victim->sharedCount, victim->sharedCount - take, __ATOMIC_RELAXED);
+            memcpy(self->items + self->count, victim->shared + victim->sharedCount, sizeof(Obj*) * take);
+            self->count += take;
+            __atomic_sub_fetch(&sharedTotal, take, __ATOMIC_SEQ_CST);
+        }
+        pthread_mutex_unlock(&victim->lock);
+
+        if (take > 0) return true;
+    }
+
+    return false;
+}
+
+/**
+ * 各ワーカーのマーキングループ．
+ *
+ * @note 終了判定：
+ *  全てのワーカーが待機中で，かつ共有スタックが空であれば，
+ *  もう誰もグレーオブジェクトを生み出せないので，マーキングは完了している．
+ */
+static void* markWorkerMain(void* arg) {
+    MarkWorker* self = (MarkWorker*)arg;
+    currentWorker = self;
+
+    for (;;) {
+        while (self->count > 0) {
+            Obj* object = self->items[--self->count];
+            blackenObject(object);
+
+            if (
+                self->count > GC_PUBLISH_THRESHOLD
+                && __atomic_load_n(&self->sharedCount, __ATOMIC_RELAXED) == 0
+            ) {
+                publishWork(self);
+            }
+        }
+
+        if (takeWork(self)) continue;
+
+        __atomic_add_fetch(&idleWorkers, 1, __ATOMIC_SEQ_CST);
+        for (;;) {
+            if (__atomic_load_n(&sharedTotal, __ATOMIC_SEQ_CST) > 0) {
+                __atomic_sub_fetch(&idleWorkers, 1, __ATOMIC_SEQ_CST);
+                break; // 誰かが仕事を公開したので，盗みに行く．
+            }
+            if (__atomic_load_n(&idleWorkers, __ATOMIC_SEQ_CST) == workerCount) {
+                currentWorker = NULL;
+                return NULL;
+            }
+            sched_yield();
+        }
+    }
+}
+
+/**
+ * ルートから集めたグレースタックを各ワーカーに配り，複数スレッドで参照を辿る．
+ *
+ * @note メインスレッドもワーカー 0 番として参加する．
+ */
+static void traceReferencesParallel(int threadCount) {
+    workerCount = threadCount;
+    idleWorkers = 0;
+    sharedTotal = 0;
+
+    if (!workersInitialized) {
+        for (int i = 0; i < GC_MAX_MARK_THREADS; i++) {
+            pthread_mutex_init(&workers[i].lock, NULL);
+        }
+        workersInitialized = true;
+    }
+
+    for (int i = 0; i < workerCount; i++) {
+        MarkWorker* worker = &workers[i];
+        worker->count = 0;
+        worker->sharedCount = 0;
+        worker->started = false;
+    }
+
+    // ルートを共有スタックに振り分けて，どのスレッドからでも盗めるようにしておく．
+    for (int i = 0; i < vm.grayCount; i++) {
+        MarkWorker* worker = &workers[i % workerCount];
+        worker->shared = growGrayArray(worker->shared, &worker->sharedCapacity, worker->sharedCount + 1);
+        worker->shared[worker->sharedCount++] = vm.grayStack[i];
+    }
+    sharedTotal = vm.grayCount;
+    vm.grayCount = 0;
+
+    // @note ワーカーはシグナルマスクを引き継ぐので，プロファイラの SIGPROF がメインスレッドにだけ届くように，起動する間だけブロックする．ref. プロファイリング
+    sigset_t blocked, previous;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGPROF);
+    pthread_sigmask(SIG_BLOCK, &blocked, &previous);
+
+    for (int i = 1; i < workerCount; i++) {
+        MarkWorker* worker = &workers[i];
+        worker->started = pthread_create(&worker->thread, NULL, markWorkerMain, worker) == 0;
+
+        // 起動に失敗したワーカーは，ずっと待機中のものとして扱う（共有スタックの中身は他のワーカーが盗む）．
+        if (!worker->started) __atomic_add_fetch(&idleWorkers, 1, __ATOMIC_SEQ_CST);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+    markWorkerMain(&workers[0]);
+
+    for (int i = 1; i < workerCount; i++) {
+        if (workers[i].started) pthread_join(workers[i].thread, NULL);
+    }
 }
 
 /**
  * グレースタックの中身がなくなるまで，参照を辿って，マーキングとグレースタックへの削除・追加を行う．
  *
+ * @note 十分に大きなヒープであれば，複数スレッドで並列に辿る．そうでなければシングルスレッドで辿る．
  * @note 削除だけでなく，グレースタックへの追加も行われる．最終的にグレースタックが無くなるまで，ループが続く．
  *       ref. 三色抽象化
  */
 static void traceReferences() {
-    while (vm.grayCount > 0) {
-        Obj* object = vm.grayStack[--vm.grayCount]; // note: 後置デクリメント：先にデクリメントしてから，その新しい値をインデックスに使う．
-        blackenObject(object);
+    int threadCount = vm.gcThreads < GC_MAX_MARK_THREADS ? vm.gcThreads : GC_MAX_MARK_THREADS;
+
+    if (threadCount > 1 && vm.bytesAllocated >= GC_PARALLEL_MIN_HEAP) {
+        traceReferencesParallel(threadCount);
+    } else {
+        traceReferencesSerial();
     }
 }
 
 /**
- * 白オブジェクトのメモリ割り当てを解放し，再利用可能な状態にする．
+ * 所与の Obj チェーンから白オブジェクトを外してメモリ割り当てを解放し，再利用可能な状態にする．
  * ref. 三色抽象化
+ *
+ * @return 生き残ったオブジェクトのうち，チェーンの末尾にあるもの．@note 生き残りがいなければ NULL．
  */
-static void sweep() {
+static Obj* sweepList(Obj** list) {
     Obj* previous = NULL;
-    Obj* object = vm.objects;
+    Obj* object = *list;
     while (object != NULL) {
-        if (object->isMarked) {
-            object->isMarked = false; // 次回のGCのために，マークをクリアする．
+        if (!isWhite(object)) {
             previous = object;
-            object = object->next;
+            object = objNext(object);
         } else {
             Obj* unreached = object;
 
             // オブジェクトチェーンの繋ぎ直し
-            object = object->next;
+            object = objNext(object);
             if (previous != NULL) {
-                previous->next = object;
+                setObjNext(previous, object);
             } else {
                 // 先頭のオブジェクトを解放する場合
-                vm.objects = object;
+                *list = object;
             }
 
             freeObject(unreached);
         }
     }
+
+    return previous;
+}
+
+/**
+ * 記憶集合を空にする．
+ *
+ * @warning メジャーGCでは記憶集合のオブジェクト自体が回収されうるので，スイープより前に呼ぶ．
+ */
+static void forgetRemembered() {
+    for (int i = 0; i < vm.rememberedCount; i++) {
+        vm.remembered[i]->isRemembered = false;
+    }
+    vm.rememberedCount = 0;
+}
+
+/**
+ * 若いうちにインターン化された文字列のうち，死んだものを文字列表から外す．
+ *
+ * @note 文字列表全体を走査しないので，マイナーGCの時間は，古い世代にインターン化された文字列がいくつあっても変わらない．
+ */
+static void removeWhiteYoungStrings() {
+    for (int i = 0; i < vm.youngStringCount; i++) {
+        ObjString* string = vm.youngStrings[i];
+        if (isWhite((Obj*)string)) tableDelete(&vm.strings, string);
+    }
+}
+
+/**
+ * 若い世代の生き残りを全て古い世代に昇格させる．
+ *
+ * @note 若い世代が空になるので，古い世代から若い世代への参照も無くなり，記憶集合も空にできる．
+ *       若いうちにインターン化された文字列の記録も，同じ理由で空にする．
+ */
+static void promoteYoung(Obj* youngTail) {
+    for (Obj* object = vm.youngObjects; object != NULL; object = objNext(object)) {
+        object->isYoung = false;
+    }
+    vm.youngStringCount = 0;
+
+    if (youngTail != NULL) {
+        setObjNext(youngTail, vm.objects);
+        vm.objects = vm.youngObjects;
+    }
+    vm.youngObjects = NULL;
 }
 
-void collectGarbage() {
 #ifdef DEBUG_LOG_GC
-    printf("-- gc begin\n");
+static size_t bytesBeforeCycle; // サイクル開始時点のヒープサイズ（ログ出力用）
+#endif
+
+/**
+ * スイープを始める．
+ *
+ * @note 若い世代は（ナーサリのサイズで抑えられているので）その場でスイープして昇格させるが，
+ *       古い世代のチェーンは未スイープのチェーンに付け替えるだけで，実際の回収は後の割り当てに任せる．ref. 遅延スイープ
+ */
+static void sweep() {
+    uint64_t start = nowNanos();
+
+    forgetRemembered();
+
+    vm.unsweptObjects = vm.objects;
+    vm.objects = NULL;
+    sweepPrevious = NULL;
+    sweeping = true;
+
+    size_t before = vm.bytesAllocated;
+    promoteYoung(sweepList(&vm.youngObjects));
+    sweptBytes = before - vm.bytesAllocated;
+
+    gcStats.sweepNanos += nowNanos() - start;
+}
+
+static double smooth(double average, double sample) {
+    return average == 0 ? sample : average + (sample - average) * GC_POLICY_SMOOTHING;
+}
+
+/**
+ * 今回のサイクルの実測値から，次回のGCの閾値を求める．ref. 適応的なヒープサイズ調整
+ *
+ * @param live 生き残ったオブジェクトの総バイト数
+ */
+static size_t nextHeapThreshold(size_t live) {
+    double threshold;
+
+    if (vm.gcOverheadTarget <= 0) {
+        threshold = (double)live * GC_HEAP_GROW_FACTOR;
+    } else {
+        uint64_t now = nowNanos();
+        uint64_t gcNanos = gcStats.pauseNanos + lazySweepNanos;
+        uint64_t majorNanos = gcNanos - gcStats.minorNanos - gcStats.compactNanos; // ヒープの閾値で頻度が変わるのは，メジャーGCだけ．
+        uint64_t elapsed = now - (lastCycleEndNanos != 0 ? lastCycleEndNanos : gcStats.startNanos);
+        uint64_t gcElapsed = gcNanos - lastGcNanos;
+
+        if (elapsed > gcElapsed) {
+            double mutatorSeconds = (double)(elapsed - gcElapsed) / 1e9;
+            averageAllocationRate = smooth(averageAllocationRate, (double)(gcStats.totalAllocated - lastTotalAllocated) / mutatorSeconds);
+        }
+        averageCycleSeconds = smooth(averageCycleSeconds, (double)(majorNanos - lastMajorNanos) / 1e9);
+
+        lastCycleEndNanos = now;
+        lastGcNanos = gcNanos;
+        lastMajorNanos = majorNanos;
+        lastTotalAllocated = gcStats.totalAllocated;
+
+        // 1サイクルあたりのGCの時間を g，割り当て速度を r，閾値までの余裕を H とすると，次のサイクルまでのミューテータの時間は H / r．
+        // GCに使う時間の割合 g / (g + H / r) を目標 t 以下にするには，H >= r * g * (1 - t) / t であればよい．
+        double target = vm.gcOverheadTarget < 100 ? vm.gcOverheadTarget / 100.0 : 0.99;
+        double headroom = averageAllocationRate * averageCycleSeconds * (1 - target) / target;
+
+        // ほとんど生き残ったサイクルは回収の効果が薄いので，余裕を多めに取る．
+        // @note サイクルの途中にも割り当ては進むので，生き残った量ではなく，解放した量から生存率を求める．
+        double survival = 0;
+        if (gcStats.heapBefore > sweptBytes) survival = 1.0 - (double)sweptBytes / (double)gcStats.heapBefore;
+        double minGrow = survival >= GC_HIGH_SURVIVAL ? GC_HEAP_GROW_FACTOR : GC_MIN_GROW_FACTOR;
+
+        if (headroom < live * (minGrow - 1)) headroom = live * (minGrow - 1);
+        if (headroom > live * (GC_MAX_GROW_FACTOR - 1)) headroom = live * (GC_MAX_GROW_FACTOR - 1);
+        threshold = live + headroom;
+
+#ifdef DEBUG_LOG_GC
+        printf("   survival %.2f, allocation %.0f bytes/s, cycle %.3f ms\n",
+            survival, averageAllocationRate, averageCycleSeconds * 1e3
+        );
+#endif
+    }
+
+    if (threshold < GC_MIN_HEAP) threshold = GC_MIN_HEAP;
+
+    // ヒープサイズの上限を超えないように，早めにGCする．@note ただし，生きているオブジェクトだけで上限に迫っている場合は，GCを繰り返さないように最低限の余裕は残す．
+    if (vm.gcMaxHeap > 0 && threshold > vm.gcMaxHeap) {
+        threshold = vm.gcMaxHeap;
+        if (threshold < live * GC_MIN_GROW_FACTOR) threshold = live * GC_MIN_GROW_FACTOR;
+    }
+
+    // ヒープの上限に達する前に，通常のGCが始まるようにする．ref. ヒープの上限
+    if (vm.heapLimit > 0 && threshold > vm.heapLimit) threshold = vm.heapLimit;
+
+    return (size_t)threshold;
+}
+
+/**
+ * スイープを終えたら，生き残ったオブジェクトの量などに合わせて次回のGCの閾値を決め直す．
+ */
+static void endSweep() {
+    // GCがメモリを解放する時にも reallocate() は呼ばれるので，
+    // この時点で vm.bytesAllocated は解放後のバイト数（＋スイープ中に新しく割り当てたバイト数）に一致している．
+    vm.nextGC = nextHeapThreshold(vm.bytesAllocated);
+    gcStats.heapAfter = vm.bytesAllocated;
+
+    // 断片化が進んでいれば，次のセーフポイントでコンパクションを行う．ref. コンパクション
+    if (
+        vm.gcCompactThreshold > 0
+        && poolFootprint(POOL_OBJECT) >= GC_COMPACT_MIN_HEAP
+        && poolFragmentation(POOL_OBJECT) * 100 >= vm.gcCompactThreshold
+    ) {
+        vm.gcCompactPending = true;
+    }
+
+#ifdef DEBUG_LOG_GC
+    printf("-- sweep end\n");
+    printf("   heap from %zu to %zu bytes (including allocations during sweep) next at %zu\n",
+        bytesBeforeCycle, vm.bytesAllocated, vm.nextGC
+    );
+#endif
+}
+
+/**
+ * 未スイープのチェーンから，最大 budget 個のオブジェクトをスイープする．ref. 遅延スイープ
+ *
+ * @note 生き残ったオブジェクトには書き込まず，チェーンに残したまま次へ進む．
+ *       チェーンの末尾まで進んだら，チェーンごと古い世代のチェーンに戻す．
+ */
+static void sweepSome(int budget) {
+    uint64_t start = nowNanos();
+    Obj* object = sweepPrevious != NULL ? objNext(sweepPrevious) : vm.unsweptObjects;
+
+    while (object != NULL && budget-- > 0) {
+        Obj* next = objNext(object);
+
+        if (poolIsMarked(object)) {
+            sweepPrevious = object;
+        } else {
+            if (sweepPrevious != NULL) {
+                setObjNext(sweepPrevious, next);
+            } else {
+                vm.unsweptObjects = next;
+            }
+            size_t before = vm.bytesAllocated;
+            freeObject(object);
+            sweptBytes += before - vm.bytesAllocated;
+        }
+
+        object = next;
+    }
+
+    if (object == NULL) {
+        if (sweepPrevious != NULL) {
+            setObjNext(sweepPrevious, vm.objects);
+            vm.objects = vm.unsweptObjects;
+        }
+        vm.unsweptObjects = NULL;
+        sweepPrevious = NULL;
+        sweeping = false;
+        endSweep();
+    }
+
+    uint64_t nanos = nowNanos() - start;
+    gcStats.sweepNanos += nanos;
+    if (pauseDepth == 0) lazySweepNanos += nanos;
+}
+
+/**
+ * 残っている遅延スイープを全て終わらせる．@note マークを使う処理（次のGCサイクルやコンパクション）の前に呼ぶ．
+ */
+static void finishSweep() {
+    if (sweeping) sweepSome(INT_MAX);
+}
+
+/**
+ * マイナーGC：若い世代のオブジェクトだけを回収する．ref. 世代別GC
+ *
+ * @note ルートと記憶集合から辿れる若いオブジェクトだけをマークするので，
+ *       かかる時間は，ヒープ全体ではなく，生きている若いオブジェクトの量に比例する．
+ */
+static void collectYoung() {
+#ifdef DEBUG_LOG_GC
+    printf("-- minor gc begin\n");
     size_t before = vm.bytesAllocated;
 #endif
 
+    beginPause();
+    uint64_t start = nowNanos();
+    vm.gcMinor = true;
+
     markRoots();
+
+    // 記憶集合の古いオブジェクトは，黒として扱ったうえで，その参照先（若いオブジェクト）を辿る．
+    for (int i = 0; i < vm.rememberedCount; i++) {
+        blackenObject(vm.remembered[i]);
+    }
+
+    traceReferencesSerial();
+    removeWhiteYoungStrings();
+    promoteYoung(sweepList(&vm.youngObjects));
+    forgetRemembered();
+
+    vm.gcMinor = false;
+    vm.nextMinorGC = vm.bytesAllocated + vm.nurserySize;
+
+    gcStats.minorCollections++;
+    gcStats.minorNanos += nowNanos() - start;
+    endPause();
+
+#ifdef DEBUG_LOG_GC
+    printf("-- minor gc end\n");
+    printf("   collocted %zu bytes (from %zu to %zu)\n",
+        before - vm.bytesAllocated, before, vm.bytesAllocated
+    );
+#endif
+}
+
+/**
+ * GCサイクルを開始し，ルートオブジェクトをグレーにする．
+ *
+ * @note インクリメンタルGCの場合，この後のグレースタックの処理は，ミューテータの割り当てに合わせて少しずつ進める．
+ */
+static void beginCycle() {
+    beginPause();
+    finishSweep();
+    poolClearMarks(POOL_OBJECT); // ref. サイドテーブル方式のマーク
+    gcStats.heapBefore = vm.bytesAllocated;
+
+#ifdef DEBUG_LOG_GC
+    printf("-- gc begin\n");
+    bytesBeforeCycle = vm.bytesAllocated;
+#endif
+
+    vm.gcMarking = true;
+    vm.nextGCStep = vm.bytesAllocated + GC_STEP_SIZE;
+
+    uint64_t start = nowNanos();
+    markRoots();
+    gcStats.markNanos += nowNanos() - start;
+    endPause();
+}
+
+/**
+ * 予算（budget）の個数だけグレーオブジェクトを暗黒化する．
+ *
+ * @return true: グレースタックが空になった．
+ */
+static bool markSlice(int budget) {
+    uint64_t start = nowNanos();
+    while (vm.grayCount > 0 && budget-- > 0) {
+        Obj* object = vm.grayStack[--vm.grayCount];
+        blackenObject(object);
+    }
+    gcStats.markNanos += nowNanos() - start;
+    return vm.grayCount == 0;
+}
+
+/**
+ * 再マークを行って残りのマーキングを完了させ，白オブジェクトを回収してGCサイクルを終える．
+ */
+static void finishCycle() {
+    beginPause();
+
+    uint64_t start = nowNanos();
+    markStackRoots();
     traceReferences();
+    uint64_t traced = nowNanos();
     tableRemoveWhite(&vm.strings);
-    sweep();
+    gcStats.traceNanos += traced - start;
+    gcStats.stringsNanos += nowNanos() - traced;
 
-    // GCがメモリを解放する時にも reallocate() は呼ばれるので，
-    // この時点で vm.bytesAllocated は解放後のバイト数に一致している．
-    vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
+    sweep();
+    vm.gcMarking = false;
+    vm.nextMinorGC = vm.bytesAllocated + vm.nurserySize;
+    gcStats.majorCollections++;
 
 #ifdef DEBUG_LOG_GC
     printf("-- gc end\n");
-    printf("   collocted %zu bytes (from %zu to %zu) next at %zu\n",
-        before - vm.bytesAllocated, before, vm.bytesAllocated, vm.nextGC
-    );
 #endif
+
+    sweepSome(0); // 古い世代が空であれば，この場でスイープを終える．
+    endPause();
 }
 
-void freeObjects() {
-    Obj* object = vm.objects;
+/**
+ * インクリメンタルマーキングを1スライス分だけ進める．
+ *
+ * @note 1回の停止時間は，ヒープサイズではなく，スライスの予算（vm.gcSliceBudget）によって抑えられる．
+ */
+static void stepGarbage() {
+    beginPause();
+    vm.nextGCStep = vm.bytesAllocated + GC_STEP_SIZE;
+
+#ifdef DEBUG_LOG_GC
+    printf("-- gc slice (%d gray)\n", vm.grayCount);
+#endif
+
+    if (markSlice(vm.gcSliceBudget)) {
+        finishCycle();
+    }
+    endPause();
+}
+
+void collectGarbage() {
+    beginPause();
+    // 進行中のサイクルがあれば，それを最後まで終わらせる．
+    if (!vm.gcMarking) beginCycle();
+    finishCycle();
+    endPause();
+}
+
+/**
+ * @return オブジェクトの（プールから割り当てた）サイズ．
+ */
+static size_t objectSize(Obj* object) {
+    switch (object->type) {
+        case OBJ_BOUND_METHOD: return sizeof(ObjBoundMethod);
+        case OBJ_CLASS: return sizeof(ObjClass);
+        case OBJ_CLOSURE: return sizeof(ObjClosure) + sizeof(ObjUpvalue*) * ((ObjClosure*)object)->upvalueCount;
+        case OBJ_FUNCTION: return sizeof(ObjFunction);
+        case OBJ_INSTANCE: return sizeof(ObjInstance);
+        case OBJ_LIST: return sizeof(ObjList);
+        case OBJ_MAP: return sizeof(ObjMap);
+        case OBJ_NATIVE: return sizeof(ObjNative);
+        case OBJ_ROPE: return sizeof(ObjRope);
+        case OBJ_STRING: return sizeof(ObjString) + ((ObjString*)object)->length + 1;
+        case OBJ_TYPED_ARRAY: return sizeof(ObjTypedArray);
+        case OBJ_UPVALUE: return sizeof(ObjUpvalue);
+    }
+    return 0; // Unreachable.
+}
+
+/**
+ * 退避済みのオブジェクトであれば，その移動先を返す．
+ *
+ * @note 退避元に残った古いコピーの next フィールドを，移動先を指す転送ポインタとして使う．
+ */
+static Obj* forward(Obj* object) {
+    if (object != NULL && poolIsEvacuating(object)) return objNext(object);
+    return object;
+}
+
+static Value forwardValue(Value value) {
+    if (IS_OBJ(value)) return OBJ_VAL(forward(AS_OBJ(value)));
+    return value;
+}
+
+static void forwardArray(ValueArray* array) {
+    for (int i = 0; i < array->count; i++) {
+        array->values[i] = forwardValue(array->values[i]);
+    }
+}
+
+/**
+ * @note キーの文字列が移動しても，ハッシュ値は文字列オブジェクト自身が持っているので，再ハッシュは不要．
+ */
+static void forwardTable(Table* table) {
+    for (int i = 0; i < table->capacity; i++) {
+        Entry* entry = &table->entries[i];
+        entry->key = (ObjString*)forward((Obj*)entry->key);
+        entry->value = forwardValue(entry->value);
+    }
+}
+
+/**
+ * @note 文字列以外のオブジェクトのキーはアドレスでハッシュしているので，それが移動した場合に限り並べ直す．ref. マップ
+ */
+static void forwardMap(Map* map) {
+    bool moved = false;
+    for (int i = 0; i < map->capacity; i++) {
+        MapEntry* entry = &map->entries[i];
+        Value key = forwardValue(entry->key);
+        if (IS_OBJ(key) && AS_OBJ(key) != AS_OBJ(entry->key) && !IS_STRING(key)) moved = true;
+        entry->key = key;
+        entry->value = forwardValue(entry->value);
+    }
+    if (moved) mapRehash(map);
+}
+
+/**
+ * 所与のオブジェクトが持つ参照を，全て移動先に付け替える．@note blackenObject() と同じ参照を辿る．
+ */
+static void forwardReferences(Obj* object) {
+    switch (object->type) {
+        case OBJ_BOUND_METHOD: {
+            ObjBoundMethod* bound = (ObjBoundMethod*)object;
+            bound->receiver = forwardValue(bound->receiver);
+            bound->method = (ObjClosure*)forward((Obj*)bound->method);
+            break;
+        }
+        case OBJ_CLASS: {
+            ObjClass* klass = (ObjClass*)object;
+            klass->name = (ObjString*)forward((Obj*)klass->name);
+            forwardTable(&klass->methods);
+            for (int i = 0; i < klass->vtableCount; i++) {
+                klass->vtable[i] = (ObjClosure*)forward((Obj*)klass->vtable[i]);
+            }
+            for (int i = 0; i < klass->sparseCapacity; i++) {
+                klass->sparseMethods[i].method = (ObjClosure*)forward((Obj*)klass->sparseMethods[i].method);
+            }
+            klass->initializer = (ObjClosure*)forward((Obj*)klass->initializer);
+            break;
+        }
+        case OBJ_CLOSURE: {
+            ObjClosure* closure = (ObjClosure*)object;
+            closure->function = (ObjFunction*)forward((Obj*)closure->function);
+            for (int i = 0; i < closure->upvalueCount; i++) {
+                closure->upvalues[i] = (ObjUpvalue*)forward((Obj*)closure->upvalues[i]);
+            }
+            break;
+        }
+        case OBJ_FUNCTION: {
+            ObjFunction* function = (ObjFunction*)object;
+            function->name = (ObjString*)forward((Obj*)function->name);
+            forwardArray(&function->chunk.constants);
+            break;
+        }
+        case OBJ_INSTANCE: {
+            ObjInstance* instance = (ObjInstance*)object;
+            instance->klass = (ObjClass*)forward((Obj*)instance->klass);
+            forwardTable(&instance->fields);
+            break;
+        }
+        case OBJ_LIST:
+            forwardArray(&((ObjList*)object)->items);
+            break;
+        case OBJ_MAP:
+            forwardMap(&((ObjMap*)object)->table);
+            break;
+        case OBJ_ROPE: {
+            ObjRope* rope = (ObjRope*)object;
+            rope->left = forward(rope->left);
+            rope->right = forward(rope->right);
+            rope->flat = (ObjString*)forward((Obj*)rope->flat);
+            break;
+        }
+        case OBJ_UPVALUE: {
+            ObjUpvalue* upvalue = (ObjUpvalue*)object;
+            upvalue->closed = forwardValue(upvalue->closed);
+            upvalue->next = (ObjUpvalue*)forward((Obj*)upvalue->next); // オープン上位値のリスト
+            break;
+        }
+        case OBJ_NATIVE:
+        case OBJ_STRING:
+        case OBJ_TYPED_ARRAY:
+            break;
+    }
+}
 
+/**
+ * 所与の Obj チェーンのうち，退避元のブロックにあるオブジェクトを，別のブロックにコピーする．
+ */
+static void evacuateList(Obj* object) {
     while (object != NULL) {
-        Obj* next = object->next;
+        Obj* next = objNext(object);
+
+        if (poolIsEvacuating(object)) {
+            size_t size = objectSize(object);
+            Obj* copy = (Obj*)poolReallocate(POOL_OBJECT, NULL, 0, size);
+            if (copy == NULL) exit(1); // アロケーションの失敗．
+            memcpy(copy, object, size);
+
+            // クローズ済みの上位値は，自分自身のフィールドを指しているので，移動先のフィールドを指し直す．
+            ObjUpvalue* upvalue = (ObjUpvalue*)object;
+            if (object->type == OBJ_UPVALUE && upvalue->location == &upvalue->closed) {
+                ((ObjUpvalue*)copy)->location = &((ObjUpvalue*)copy)->closed;
+            }
+
+            setObjNext(object, copy); // 転送ポインタ
+        }
+
+        object = next;
+    }
+}
+
+/**
+ * 所与の Obj チェーンの繋がりと，チェーン上の各オブジェクトが持つ参照を，移動先に付け替える．
+ */
+static void forwardList(Obj** list) {
+    *list = forward(*list);
+    for (Obj* object = *list; object != NULL; object = objNext(object)) {
+        setObjNext(object, forward(objNext(object))); // @note 移動先のコピーの next は，まだ退避前の次のオブジェクトを指している．
+        forwardReferences(object);
+    }
+}
+
+void compactHeap() {
+    if (vm.gcMarking) return; // マーキング中はグレースタックなどにも参照が散らばっているので，サイクルが終わるまで待つ．
+    vm.gcCompactPending = false;
+    finishSweep();
+
+#ifdef DEBUG_LOG_GC
+    printf("-- compact begin\n");
+    size_t before = poolFootprint(POOL_OBJECT);
+#endif
+
+    if (!poolBeginEvacuation(POOL_OBJECT)) return;
+
+    beginPause();
+    uint64_t start = nowNanos();
+    profilePhase = PROFILE_COMPACTING; // ここからオブジェクトが移動する．
+
+    evacuateList(vm.objects);
+    evacuateList(vm.youngObjects);
+
+    // ヒープ上の参照
+    forwardList(&vm.objects);
+    forwardList(&vm.youngObjects);
+
+    // ルートの参照
+    for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
+        *slot = forwardValue(*slot);
+    }
+    for (int i = 0; i < vm.frameCount; i++) {
+        vm.frames[i].closure = (ObjClosure*)forward((Obj*)vm.frames[i].closure);
+    }
+    vm.openUpvalues = (ObjUpvalue*)forward((Obj*)vm.openUpvalues);
+    vm.initString = (ObjString*)forward((Obj*)vm.initString);
+    forwardArray(&vm.methodNames);
+    forwardTable(&vm.globals);
+    forwardTable(&vm.strings);
+    for (int i = 0; i < vm.rememberedCount; i++) {
+        vm.remembered[i] = forward(vm.remembered[i]);
+    }
+    for (int i = 0; i < vm.youngStringCount; i++) {
+        vm.youngStrings[i] = (ObjString*)forward((Obj*)vm.youngStrings[i]);
+    }
+
+    poolEndEvacuation(POOL_OBJECT);
+    profilePhase = PROFILE_GC;
+
+    gcStats.compactions++;
+    gcStats.compactNanos += nowNanos() - start;
+    endPause();
+
+#ifdef DEBUG_LOG_GC
+    printf("-- compact end\n");
+    printf("   object pools shrank from %zu to %zu bytes\n", before, poolFootprint(POOL_OBJECT));
+#endif
+}
+
+static void freeList(Obj* object) {
+    while (object != NULL) {
+        Obj* next = objNext(object);
         freeObject(object);
         object = next;
     }
+}
+
+void freeObjects() {
+    freeList(vm.objects);
+    freeList(vm.youngObjects);
+    freeList(vm.unsweptObjects);
+    sweeping = false;
+    sweepPrevious = NULL;
+    vm.objects = NULL;
+    vm.youngObjects = NULL;
+    vm.unsweptObjects = NULL;
+
+    freePools();
+
+    free(vm.remembered);
+    vm.remembered = NULL;
+    vm.rememberedCount = 0;
+    vm.rememberedCapacity = 0;
+
+    free(vm.youngStrings);
+    vm.youngStrings = NULL;
+    vm.youngStringCount = 0;
+    vm.youngStringCapacity = 0;
 
     free(vm.grayStack);
+    vm.gcMarking = false;
+
+    if (workersInitialized) {
+        for (int i = 0; i < GC_MAX_MARK_THREADS; i++) {
+            free(workers[i].items);
+            free(workers[i].shared);
+            pthread_mutex_destroy(&workers[i].lock);
+        }
+        workersInitialized = false;
+    }
+}
+
+/**
+ * 型ごとの統計の名前（"live" の後に続く部分）．@warning ObjType に新しい型を追加したら，ここにも追加する．
+ */
+static const char* liveObjectNames[OBJ_TYPE_COUNT] = {
+    [OBJ_BOUND_METHOD] = "BoundMethods",
+    [OBJ_CLASS] = "Classes",
+    [OBJ_CLOSURE] = "Closures",
+    [OBJ_FUNCTION] = "Functions",
+    [OBJ_INSTANCE] = "Instances",
+    [OBJ_LIST] = "Lists",
+    [OBJ_MAP] = "Maps",
+    [OBJ_NATIVE] = "Natives",
+    [OBJ_ROPE] = "Ropes",
+    [OBJ_STRING] = "Strings",
+    [OBJ_TYPED_ARRAY] = "TypedArrays",
+    [OBJ_UPVALUE] = "Upvalues",
+};
+
+void initGcStats() {
+    memset(&gcStats, 0, sizeof(gcStats));
+    gcStats.startNanos = nowNanos();
+}
+
+static double nanosToMillis(uint64_t nanos) {
+    return (double)nanos / 1e6;
+}
+
+/**
+ * @return 起動からの平均の割り当て速度（バイト／秒）
+ */
+static double allocationRate() {
+    double seconds = (double)(nowNanos() - gcStats.startNanos) / 1e9;
+    return seconds > 0 ? (double)gcStats.totalAllocated / seconds : 0;
+}
+
+static int liveObjectCount() {
+    int count = 0;
+    for (int type = 0; type < OBJ_TYPE_COUNT; type++) {
+        count += gcStats.liveObjects[type];
+    }
+    return count;
+}
+
+bool gcStat(const char* name, double* value) {
+    if (strcmp(name, "majorCollections") == 0) {
+        *value = gcStats.majorCollections;
+    } else if (strcmp(name, "minorCollections") == 0) {
+        *value = gcStats.minorCollections;
+    } else if (strcmp(name, "compactions") == 0) {
+        *value = gcStats.compactions;
+    } else if (strcmp(name, "pauseCount") == 0) {
+        *value = (double)gcStats.pauseCount;
+    } else if (strcmp(name, "pauseTotalMs") == 0) {
+        *value = nanosToMillis(gcStats.pauseNanos);
+    } else if (strcmp(name, "pauseMaxMs") == 0) {
+        *value = nanosToMillis(gcStats.pauseMaxNanos);
+    } else if (strcmp(name, "markMs") == 0) {
+        *value = nanosToMillis(gcStats.markNanos);
+    } else if (strcmp(name, "traceMs") == 0) {
+        *value = nanosToMillis(gcStats.traceNanos);
+    } else if (strcmp(name, "stringsMs") == 0) {
+        *value = nanosToMillis(gcStats.stringsNanos);
+    } else if (strcmp(name, "sweepMs") == 0) {
+        *value = nanosToMillis(gcStats.sweepNanos);
+    } else if (strcmp(name, "minorMs") == 0) {
+        *value = nanosToMillis(gcStats.minorNanos);
+    } else if (strcmp(name, "compactMs") == 0) {
+        *value = nanosToMillis(gcStats.compactNanos);
+    } else if (strcmp(name, "bytesAllocated") == 0) {
+        *value = (double)vm.bytesAllocated;
+    } else if (strcmp(name, "heapBefore") == 0) {
+        *value = (double)gcStats.heapBefore;
+    } else if (strcmp(name, "heapAfter") == 0) {
+        *value = (double)gcStats.heapAfter;
+    } else if (strcmp(name, "peakHeap") == 0) {
+        *value = (double)gcStats.peakHeap;
+    } else if (strcmp(name, "totalAllocated") == 0) {
+        *value = (double)gcStats.totalAllocated;
+    } else if (strcmp(name, "allocationRate") == 0) {
+        *value = allocationRate();
+    } else if (strcmp(name, "liveObjects") == 0) {
+        *value = liveObjectCount();
+    } else {
+        // 型ごとの生存オブジェクト数（e.g. "liveStrings"）
+        if (strncmp(name, "live", 4) != 0) return false;
+        for (int type = 0; type < OBJ_TYPE_COUNT; type++) {
+            if (strcmp(name + 4, liveObjectNames[type]) == 0) {
+                *value = gcStats.liveObjects[type];
+                return true;
+            }
+        }
+        return false;
+    }
+
+    return true;
+}
+
+void printGcStats(FILE* out) {
+    fprintf(out, "== gc stats ==\n");
+    fprintf(out, "collections     major %d, minor %d, compactions %d\n",
+        gcStats.majorCollections, gcStats.minorCollections, gcStats.compactions
+    );
+    fprintf(out, "pauses          count %llu, total %.3f ms, max %.3f ms\n",
+        (unsigned long long)gcStats.pauseCount, nanosToMillis(gcStats.pauseNanos), nanosToMillis(gcStats.pauseMaxNanos)
+    );
+    fprintf(out, "phases (ms)     mark %.3f, trace %.3f, strings %.3f, sweep %.3f, minor %.3f, compact %.3f\n",
+        nanosToMillis(gcStats.markNanos), nanosToMillis(gcStats.traceNanos), nanosToMillis(gcStats.stringsNanos),
+        nanosToMillis(gcStats.sweepNanos), nanosToMillis(gcStats.minorNanos), nanosToMillis(gcStats.compactNanos)
+    );
+    fprintf(out, "heap (bytes)    current %zu, peak %zu, last cycle %zu -> %zu\n",
+        vm.bytesAllocated, gcStats.peakHeap, gcStats.heapBefore, gcStats.heapAfter
+    );
+    fprintf(out, "allocation      total %zu bytes, rate %.0f bytes/s\n",
+        gcStats.totalAllocated, allocationRate()
+    );
+
+    fprintf(out, "pause histogram\n");
+    for (int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+        if (gcStats.pauseHistogram[i] == 0) continue;
+
+        unsigned long long low = i == 0 ? 0 : 1ull << (i - 1);
+        if (i == GC_PAUSE_BUCKETS - 1) {
+            fprintf(out, "  [%llu, inf) us: %llu\n", low, (unsigned long long)gcStats.pauseHistogram[i]);
+        } else {
+            fprintf(out, "  [%llu, %llu) us: %llu\n", low, 1ull << i, (unsigned long long)gcStats.pauseHistogram[i]);
+        }
+    }
+
+    fprintf(out, "live objects    %d\n", liveObjectCount());
+    for (int type = 0; type < OBJ_TYPE_COUNT; type++) {
+        fprintf(out, "  %-13s %d\n", liveObjectNames[type], gcStats.liveObjects[type]);
+    }
 }
@@ -1,8 +1,12 @@
 #ifndef clox_memory_h
 #define clox_memory_h
 
+#include <stdio.h>
+
 #include "common.h"
 #include "object.h"
+#include "pool.h"
+#include "vm.h"
 
 /**
  * @note void* ではなく，指定した type としてポインタを返すためにマクロでラップしている．
@@ -10,7 +14,20 @@
 #define ALLOCATE(type, count) \
     (type*)reallocate(NULL, 0, sizeof(type) * (count))
 
-#define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
+/**
+ * @note Obj 専用．オブジェクトは Obj 専用のプールから割り当てられているので，reallocateObject で解放する．
+ */
+#define FREE(type, pointer) reallocateObject(pointer, sizeof(type), 0)
+
+/**
+ * フレキシブル配列メンバ（末尾に count 個の elementType を持つ）の Obj を解放する．
+ */
+#define FREE_FLEX(type, elementType, pointer, count) \
+    reallocateObject(pointer, sizeof(type) + sizeof(elementType) * (count), 0)
+
+#define GC_MAX_MARK_THREADS 8 // 並列マーキングで使うスレッド数の上限
+#define GC_MIN_HEAP (1024 * 1024) // GCの閾値の下限（初回の閾値も兼ねる）．@note 小さなスクリプトが不要なGCを繰り返さないようにする．
+#define GC_PAUSE_BUCKETS 24 // 停止時間のヒストグラムのバケット数．@note i 番目のバケットは [2^(i-1), 2^i) マイクロ秒の停止を数える（最後のバケットはそれ以上全て）．
 
 #define GROW_CAPACITY(capacity) \
     ((capacity) < 8 ? 8 : (capacity) * 2)
@@ -36,10 +53,129 @@
  */
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
 
+/**
+ * reallocate と同じだが，Obj 専用のプールから割り当てる．@note コンパクションで移動できるのは，このプールのオブジェクトだけ．
+ */
+void* reallocateObject(void* pointer, size_t oldSize, size_t newSize);
+
 void markObject(Obj* object);
 void markValue(Value value);
+
+/**
+ * GCサイクルを（進行中のものがあればその続きから）最後まで実行する．
+ */
 void collectGarbage();
 
+/**
+ * 使用率の低いブロックから生きているオブジェクトを退避させて詰め直し，空いたブロックをOSに返す．ref. コンパクション
+ *
+ * @warning オブジェクトが移動するので，C のローカル変数が Obj へのポインタを持っていない時点（セーフポイント）でしか呼べない．
+ *          VMの命令ループの中からだけ呼び出すこと．
+ */
+void compactHeap();
+
+/**
+ * 古いオブジェクトを記憶集合に登録する．ref. 世代別GC
+ */
+void rememberObject(Obj* object);
+
+/**
+ * 若い文字列をインターン化したことを記録する．ref. 世代別GC
+ *
+ * @note マイナーGCは，文字列表（弱参照）のうち，ここで記録した文字列のエントリだけを掃除する．
+ */
+void rememberYoungString(ObjString* string);
+
+/**
+ * 書き込みバリア
+ *
+ * 既存のオブジェクトやルートに参照を書き込む時に必ず通す．
+ *
+ * @param owner 書き込み先のオブジェクト．@note ルート（グローバル変数の表など）への書き込みの場合は NULL．
+ * @note インクリメンタルGCのマーキング中は，ミューテータが黒オブジェクトに白オブジェクトへの参照を書き込むと，
+ *       その白オブジェクトが二度と辿られずに回収されてしまう．
+ *       それを防ぐため，書き込まれる値をグレーにしておく（ダイクストラ式の挿入バリア）．
+ * @note 古いオブジェクトに若いオブジェクトへの参照を書き込む場合は，
+ *       マイナーGCで辿れるように，書き込み先を記憶集合に登録しておく．
+ */
+static inline void writeBarrier(Obj* owner, Value value) {
+    if (vm.gcMarking) markValue(value);
+
+    if (
+        owner != NULL
+        && !owner->isYoung
+        && !owner->isRemembered
+        && IS_OBJ(value)
+        && AS_OBJ(value)->isYoung
+    ) {
+        rememberObject(owner);
+    }
+}
+
+/**
+ * @return true: 今回のGCでまだ到達していない（回収対象の）オブジェクト．
+ * @note マイナーGCの間，古いオブジェクトは暗黙のうちに黒（到達済み）として扱う．
+ */
+static inline bool isWhite(Obj* object) {
+    return !poolIsMarked(object) && (!vm.gcMinor || object->isYoung);
+}
+
 void freeObjects();
 
+/**
+ * GCの統計情報．ref. GCテレメトリ
+ *
+ * @note GCテレメトリ
+ *  GCのチューニング（ref. CLOX Options）は，どこに時間がかかっているかが分からないと当てずっぽうになる．
+ *  そこで，停止時間の分布，フェーズごとの所要時間，型ごとの生存オブジェクト数，割り当て速度を常に集計しておく．
+ *  集計は各停止の前後で時計を読む程度なので，常に有効にしておいても性能への影響は小さい．
+ */
+typedef struct {
+    int majorCollections; // 完了したメジャーGCサイクルの回数
+    int minorCollections; // マイナーGCの回数
+    int compactions; // コンパクションの回数
+
+    // フェーズごとの累計所要時間（ナノ秒）
+    uint64_t markNanos; // ルートのマーキングとインクリメンタルマーキングのスライス
+    uint64_t traceNanos; // サイクル最後の再マークと残りのトレース
+    uint64_t stringsNanos; // インターン化済み文字列の表からの白オブジェクトの除去
+    uint64_t sweepNanos; // スイープ（遅延スイープの分も含む）
+    uint64_t minorNanos; // マイナーGC全体
+    uint64_t compactNanos; // コンパクション全体
+
+    // ミューテータを止めた時間（遅延スイープの1回分は割り当てに含めて数えない）
+    uint64_t pauseCount;
+    uint64_t pauseNanos; // 累計
+    uint64_t pauseMaxNanos; // 最大
+    uint64_t pauseHistogram[GC_PAUSE_BUCKETS];
+
+    size_t heapBefore; // 直近のメジャーGCサイクル開始時点のヒープサイズ
+    size_t heapAfter; // 直近のメジャーGCサイクルのスイープ完了時点のヒープサイズ
+    size_t peakHeap; // これまでの最大のヒープサイズ
+    size_t totalAllocated; // 起動からの累計割り当てバイト数（解放分は差し引かない）
+    uint64_t startNanos; // 統計の集計開始時刻（割り当て速度の計算に使う）
+
+    int liveObjects[OBJ_TYPE_COUNT]; // 型ごとの生存オブジェクト数（まだ回収されていないものを含む）
+} GcStats;
+
+extern GcStats gcStats;
+
+/**
+ * GCの統計情報を初期化する．@note VMの初期化時に呼ぶ．
+ */
+void initGcStats();
+
+/**
+ * 名前で指定したGCの統計値を取り出す．
+ *
+ * @param name 統計の名前（e.g. "pauseMaxMs", "liveStrings"）．ref. printGcStats()
+ * @return false: そのような名前の統計はない．
+ */
+bool gcStat(const char* name, double* value);
+
+/**
+ * GCの統計情報を人が読める形式で出力する．
+ */
+void printGcStats(FILE* out);
+
 #endif
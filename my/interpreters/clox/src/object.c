@@ -1,6 +1,8 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "hash.h"
 #include "memory.h"
 #include "object.h"
 #include "table.h"
@@ -14,11 +16,18 @@
     (type*)allocateObject(sizeof(type), objectType)
 
 static Obj* allocateObject(size_t size, ObjType type) {
-    Obj* object = (Obj*)reallocate(NULL, 0, size);
+    Obj* object = (Obj*)reallocateObject(NULL, 0, size);
     object->type = type;
-    object->isMarked = false;
-    object->next = vm.objects; // 末尾ではなく，先頭に順に繋いでいく．
-    vm.objects = object;
+    object->isRemembered = false;
+    object->isInterned = false;
+    object->isFieldName = false;
+    gcStats.liveObjects[type]++; // ref. GCテレメトリ
+
+    // 新しいオブジェクトは若い世代のチェーンに繋ぐ．@note 世代別GCが無効な場合は，最初から古い世代として扱う．
+    Obj** list = vm.nurserySize > 0 ? &vm.youngObjects : &vm.objects;
+    object->isYoung = vm.nurserySize > 0;
+    setObjNext(object, *list); // 末尾ではなく，先頭に順に繋いでいく．
+    *list = object;
 
 #ifdef DEBUG_LOG_GC
     printf("%p allocate %zu for %d\n", (void*)object, size, type);
@@ -39,19 +48,23 @@ ObjClass* newClass(ObjString* name) {
     ObjClass* klass = ALLOCATE_OBJ(ObjClass, OBJ_CLASS);
     klass->name = name;
     initTable(&klass->methods);
+    klass->vtable = NULL;
+    klass->vtableCount = 0;
+    klass->sparseMethods = NULL;
+    klass->sparseCapacity = 0;
+    klass->initializer = NULL;
     return klass;
 }
 
 ObjClosure* newClosure(ObjFunction* function) {
-    ObjUpvalue** upvalues = ALLOCATE(ObjUpvalue*, function->upvalueCount);
-    for (int i = 0; i < function->upvalueCount; i++) {
-        upvalues[i] = NULL;
-    }
-
-    ObjClosure* closure = ALLOCATE_OBJ(ObjClosure, OBJ_CLOSURE);
+    ObjClosure* closure = (ObjClosure*)allocateObject(
+        sizeof(ObjClosure) + sizeof(ObjUpvalue*) * function->upvalueCount, OBJ_CLOSURE
+    );
     closure->function = function;
-    closure->upvalues = upvalues;
     closure->upvalueCount = function->upvalueCount;
+    for (int i = 0; i < function->upvalueCount; i++) {
+        closure->upvalues[i] = NULL;
+    }
     return closure;
 }
 
@@ -60,6 +73,10 @@ ObjFunction* newFunction() {
     function->arity = 0;
     function->upvalueCount = 0;
     function->name = NULL;
+    function->profileId = -1;
+#ifdef DEBUG_COUNT_OPCODES
+    function->countId = -1;
+#endif
     initChunk(&function->chunk);
     return function;
 }
@@ -71,52 +88,165 @@ ObjInstance* newInstance(ObjClass* klass) {
     return instance;
 }
 
+ObjList* newList() {
+    ObjList* list = ALLOCATE_OBJ(ObjList, OBJ_LIST);
+    initValueArray(&list->items);
+    return list;
+}
+
+ObjMap* newMap() {
+    ObjMap* map = ALLOCATE_OBJ(ObjMap, OBJ_MAP);
+    initMap(&map->table);
+    return map;
+}
+
+ObjTypedArray* newTypedArray(TypedArrayKind kind, int length) {
+    ObjTypedArray* array = ALLOCATE_OBJ(ObjTypedArray, OBJ_TYPED_ARRAY);
+    array->kind = kind;
+    array->length = 0;
+    array->data = NULL;
+    if (length == 0) return array;
+
+    push(OBJ_VAL(array)); // GC が勝手にメモリを開放しないように一旦VMのスタックにプッシュする．
+    size_t size = typedArrayElementSize(kind) * length;
+    array->data = reallocate(NULL, 0, size);
+    memset(array->data, 0, size);
+    array->length = length;
+    pop();
+    return array;
+}
+
 ObjNative* newNative(NativeFn function) {
     ObjNative* native = ALLOCATE_OBJ(ObjNative, OBJ_NATIVE);
     native->function = function;
     return native;
 }
 
-static ObjString* allocateString(
-    char* chars,
-    int length,
-    uint32_t hash
-) {
-    ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
-    string->length = length;
-    string->chars = chars;
-    string->hash = hash;
+ObjRope* newRope(Obj* left, Obj* right) {
+    // 平坦化済みのロープは，その結果の文字列に置き換えて繋ぐ．@note 古いロープの木を回収できるようにする．
+    if (left->type == OBJ_ROPE && ((ObjRope*)left)->flat != NULL) left = (Obj*)((ObjRope*)left)->flat;
+    if (right->type == OBJ_ROPE && ((ObjRope*)right)->flat != NULL) right = (Obj*)((ObjRope*)right)->flat;
 
-    push(OBJ_VAL(string)); // GC が勝手にメモリを開放しないように一旦VMのスタックにプッシュする．
-    tableSet(&vm.strings, string, NIL_VAL); // NOTE: 値はどうでもいいので nil を使う．
+    ObjRope* rope = ALLOCATE_OBJ(ObjRope, OBJ_ROPE);
+    rope->length = stringLength(left) + stringLength(right);
+    rope->left = left;
+    rope->right = right;
+    rope->flat = NULL;
+    return rope;
+}
+
+/**
+ * ロープを辿るための（GCの管理外の）スタック．@note 深いロープを再帰で辿るとCのスタックが溢れるので，明示的なスタックを使う．
+ */
+typedef struct {
+    Obj** items;
+    int count;
+    int capacity;
+} RopeStack;
+
+static void pushRopeNode(RopeStack* stack, Obj* node) {
+    if (stack->count + 1 > stack->capacity) {
+        stack->capacity = stack->capacity < 8 ? 8 : stack->capacity * 2;
+        stack->items = (Obj**)realloc(stack->items, sizeof(Obj*) * stack->capacity);
+        if (stack->items == NULL) exit(1); // アロケーションの失敗．
+    }
+    stack->items[stack->count++] = node;
+}
+
+/**
+ * @return ロープの葉として扱える文字列．@note 平坦化済みのロープも葉として扱う．まだ平坦化していないロープなら NULL．
+ */
+static ObjString* ropeLeaf(Obj* node) {
+    if (node->type == OBJ_STRING) return (ObjString*)node;
+    return ((ObjRope*)node)->flat;
+}
+
+ObjString* flattenRope(ObjRope* rope) {
+    if (rope->flat != NULL) return rope->flat;
+
+    push(OBJ_VAL(rope)); // GC が勝手にメモリを開放しないように一旦VMのスタックにプッシュする．
+    ObjString* string = allocateString(rope->length);
+
+    // 右端の葉から順に，文字配列の末尾から詰めていく．
+    RopeStack stack = {NULL, 0, 0};
+    char* end = string->chars + rope->length;
+    pushRopeNode(&stack, (Obj*)rope);
+    while (stack.count > 0) {
+        Obj* node = stack.items[--stack.count];
+        ObjString* leaf = ropeLeaf(node);
+        if (leaf != NULL) {
+            end -= leaf->length;
+            memcpy(end, leaf->chars, leaf->length);
+        } else {
+            pushRopeNode(&stack, ((ObjRope*)node)->left);
+            pushRopeNode(&stack, ((ObjRope*)node)->right); // 後に積んだ右側から先に取り出される．
+        }
+    }
+    free(stack.items);
+    string->chars[rope->length] = '\0';
+
+    rope->flat = string;
+    writeBarrier((Obj*)rope, OBJ_VAL(string));
+    rope->left = NULL;
+    rope->right = NULL;
     pop();
 
     return string;
 }
 
 /**
- * @note ハッシュ関数: FNV-1a
+ * ロープを平坦化せずに出力する．@note GCのログ出力のように，割り当てが許されない場面からも呼ばれるので，新しい文字列は作らない．
  */
-static uint32_t hashString(const char* key, int length) {
-    uint32_t hash = 2166136261u; // 初期値（数学的な特性を慎重に検討して選択された定数）
-    for (int i = 0; i < length; i++) {
-        hash ^= (uint8_t)key[i]; // 現在のハッシュ値（hash）と文字列のi番目の文字（key[i]）の XOR を計算する．
-        hash *= 16777619; // FNV prime（分散を良くするための大きな定数）を掛ける．
+static void printRope(ObjRope* rope) {
+    RopeStack stack = {NULL, 0, 0};
+    pushRopeNode(&stack, (Obj*)rope);
+    while (stack.count > 0) {
+        Obj* node = stack.items[--stack.count];
+        ObjString* leaf = ropeLeaf(node);
+        if (leaf != NULL) {
+            fwrite(leaf->chars, 1, leaf->length, stdout);
+        } else {
+            pushRopeNode(&stack, ((ObjRope*)node)->right);
+            pushRopeNode(&stack, ((ObjRope*)node)->left); // 後に積んだ左側から先に取り出される．
+        }
     }
-    return hash;
+    free(stack.items);
 }
 
-ObjString* takeString(char* chars, int length) {
-    uint32_t hash = hashString(chars, length);
+ObjString* allocateString(int length) {
+    // ターミネータも含むので length + 1
+    ObjString* string = (ObjString*)allocateObject(sizeof(ObjString) + length + 1, OBJ_STRING);
+    string->length = length;
+    string->hash = 0;
+    string->methodSlot = -1;
+    return string;
+}
 
-    // 文字列がすでにインターン化されていれば，所有権を解放したうえで，そのポインタを返す．
-    ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
-    if (interned != NULL) {
-        FREE_ARRAY(char, chars, length + 1);
-        return interned;
-    }
+/**
+ * インターン化済みの文字列の一覧に追加する．
+ */
+static ObjString* addString(ObjString* string, uint32_t hash) {
+    string->hash = hash;
+    string->obj.isInterned = true;
+
+    push(OBJ_VAL(string)); // GC が勝手にメモリを開放しないように一旦VMのスタックにプッシュする．
+    tableSet(&vm.strings, string, NIL_VAL); // NOTE: 値はどうでもいいので nil を使う．
+    pop();
+    if (string->obj.isYoung) rememberYoungString(string);
 
-    return allocateString(chars, length, hash);
+    return string;
+}
+
+ObjString* internString(ObjString* string) {
+    if (string->obj.isInterned) return string;
+
+    uint32_t hash = hashString(string->chars, string->length);
+
+    // 文字列がすでにインターン化されていれば，そのポインタを返す．
+    ObjString* interned = tableFindString(&vm.strings, string->chars, string->length, hash);
+    if (interned != NULL) return interned;
+
+    return addString(string, hash);
 }
 
 ObjString* copyString(const char* chars, int length) {
@@ -126,16 +256,15 @@ ObjString* copyString(const char* chars, int length) {
     ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
     if (interned != NULL) return interned;
 
-    // ヒープ上に新しい配列を割り当てる．ターミネータも含むので length + 1
-    char* heapChars = ALLOCATE(char, length + 1);
+    ObjString* string = allocateString(length);
 
     // 配列に字句をコピー
-    memcpy(heapChars, chars, length);
+    memcpy(string->chars, chars, length);
 
     // NOTE: ソース文字列の一部の参照の可能性があるので，ターミネータを明示的に追加
-    heapChars[length] = '\0';
+    string->chars[length] = '\0';
 
-    return allocateString(heapChars, length, hash);
+    return addString(string, hash);
 }
 
 ObjUpvalue* newUpvalue(Value* slot) {
@@ -146,6 +275,65 @@ ObjUpvalue* newUpvalue(Value* slot) {
     return upvalue;
 }
 
+#define PRINT_MAX_DEPTH 8 // 入れ子のリストやマップを出力する深さの上限．@note 自身を要素に含むリストやマップで無限に再帰しないように，これより深い要素は省略する．
+
+static int printDepth = 0; // 出力中のリストやマップの入れ子の深さ
+
+static void printList(ObjList* list) {
+    if (printDepth >= PRINT_MAX_DEPTH) {
+        printf("[...]");
+        return;
+    }
+
+    printDepth++;
+    printf("[");
+    for (int i = 0; i < list->items.count; i++) {
+        if (i > 0) printf(", ");
+        printValue(list->items.values[i]);
+    }
+    printf("]");
+    printDepth--;
+}
+
+static void printTypedArray(ObjTypedArray* array) {
+    printf(array->kind == TYPED_FLOAT64 ? "Float64Array[" : "Int32Array[");
+    for (int i = 0; i < array->length; i++) {
+        if (i > 0) printf(", ");
+        if (array->kind == TYPED_FLOAT64) {
+            printValue(NUMBER_VAL(((double*)array->data)[i]));
+        } else {
+            printf("%d", ((int32_t*)array->data)[i]);
+        }
+    }
+    printf("]");
+}
+
+/**
+ * @note エントリはハッシュ表の格納順に出力する（追加した順ではない）．
+ */
+static void printMap(ObjMap* map) {
+    if (printDepth >= PRINT_MAX_DEPTH) {
+        printf("{...}");
+        return;
+    }
+
+    printDepth++;
+    printf("{");
+    bool first = true;
+    for (int i = 0; i < map->table.capacity; i++) {
+        MapEntry* entry = &map->table.entries[i];
+        if (IS_NIL(entry->key)) continue;
+
+        if (!first) printf(", ");
+        first = false;
+        printValue(entry->key);
+        printf(": ");
+        printValue(entry->value);
+    }
+    printf("}");
+    printDepth--;
+}
+
 static void printFunction(ObjFunction* function) {
     if (function->name == NULL) {
         // トップレベルコードの場合（関数名の有無で判別している）
@@ -163,8 +351,12 @@ void printObject(Value value) {
         case OBJ_CLOSURE: printFunction(AS_CLOSURE(value)->function); break;
         case OBJ_FUNCTION: printFunction(AS_FUNCTION(value)); break;
         case OBJ_INSTANCE: printf("%s instance", AS_INSTANCE(value)->klass->name->chars); break;
+        case OBJ_LIST: printList(AS_LIST(value)); break;
+        case OBJ_MAP: printMap(AS_MAP(value)); break;
         case OBJ_NATIVE: printf("<native fn>"); break;
+        case OBJ_ROPE: printRope(AS_ROPE(value)); break;
         case OBJ_STRING: printf("%s", AS_CSTRING(value)); break;
+        case OBJ_TYPED_ARRAY: printTypedArray(AS_TYPED_ARRAY(value)); break;
         case OBJ_UPVALUE: printf("upvalue"); break;
     }
 }
@@ -1,8 +1,11 @@
 #ifndef clox_object_h
 #define clox_object_h
 
+#include <string.h>
+
 #include "common.h"
 #include "chunk.h"
+#include "map.h"
 #include "table.h"
 #include "value.h"
 
@@ -13,17 +16,25 @@
 #define IS_CLOSURE(value) isObjType(value, OBJ_CLOSURE)
 #define IS_FUNCTION(value) isObjType(value, OBJ_FUNCTION)
 #define IS_INSTANCE(value) isObjType(value, OBJ_INSTANCE)
+#define IS_LIST(value) isObjType(value, OBJ_LIST)
+#define IS_MAP(value) isObjType(value, OBJ_MAP)
 #define IS_NATIVE(value) isObjType(value, OBJ_NATIVE)
+#define IS_ROPE(value) isObjType(value, OBJ_ROPE)
 #define IS_STRING(value) isObjType(value, OBJ_STRING)
+#define IS_TYPED_ARRAY(value) isObjType(value, OBJ_TYPED_ARRAY)
 
 #define AS_BOUND_METHOD(value) ((ObjBoundMethod*)AS_OBJ(value))
 #define AS_CLASS(value) ((ObjClass*)AS_OBJ(value))
 #define AS_CLOSURE(value) ((ObjClosure*)AS_OBJ(value))
 #define AS_FUNCTION(value) ((ObjFunction*)AS_OBJ(value))
 #define AS_INSTANCE(value) ((ObjInstance*)AS_OBJ(value))
+#define AS_LIST(value) ((ObjList*)AS_OBJ(value))
+#define AS_MAP(value) ((ObjMap*)AS_OBJ(value))
 #define AS_NATIVE(value) (((ObjNative*)AS_OBJ(value))->function)
+#define AS_ROPE(value) ((ObjRope*)AS_OBJ(value))
 #define AS_STRING(value) ((ObjString*)AS_OBJ(value))
 #define AS_CSTRING(value) (((ObjString*)AS_OBJ(value))->chars)
+#define AS_TYPED_ARRAY(value) ((ObjTypedArray*)AS_OBJ(value))
 
 typedef enum {
     OBJ_BOUND_METHOD, // インスタンスメソッド
@@ -31,11 +42,17 @@ typedef enum {
     OBJ_CLOSURE,
     OBJ_FUNCTION,
     OBJ_INSTANCE,
+    OBJ_LIST, // 動的配列．ref. リスト
+    OBJ_MAP, // 任意の値をキーに取る連想配列．ref. マップ
     OBJ_NATIVE, // 言語組み込み関数
+    OBJ_ROPE, // 連結を遅延させた文字列．ref. ロープ
     OBJ_STRING,
+    OBJ_TYPED_ARRAY, // 数値を生のC言語の配列に詰めた配列．ref. 型付き配列
     OBJ_UPVALUE,
 } ObjType;
 
+#define OBJ_TYPE_COUNT (OBJ_UPVALUE + 1) // 型の数（GCの統計で型ごとの配列を確保するために使う）．@note 列挙子にすると型の switch が -Wswitch で警告されるので，外で定義する．@warning 列挙の末尾に型を追加したら，ここも更新する．
+
 /**
  * すべてのオブジェクト型に共通する状態
  *
@@ -43,18 +60,41 @@ typedef enum {
  *      サイズが大きく可変な値．データ自体はヒープに置かれ，Value のペイロードは，
  *      そのデータを指すポインタになる．（e.g. 文字列，インスタンス，関数など）
  */
+/**
+ * @note ヘッダの圧縮
+ *  全てのオブジェクトが持つヘッダなので，ビットフィールドで 8 バイトに詰め込む．
+ *  ユーザー空間のアドレスは下位 48 ビットに収まるので，next ポインタは 48 ビットの整数として持ち，
+ *  残りの上位ビットに型とGC用のフラグを置く．next には objNext() / setObjNext() でアクセスする．
+ *
+ * @warning 48 ビットを超える仮想アドレス空間（5段のページテーブルなど）で上位のアドレスを使う環境では動作しない．
+ */
 struct Obj {
-    ObjType type;
-    bool isMarked; // GCがリサイクルするオブジェクトを判定するためのフラグ．GC実行時に到達可能であれば true がセットされ，false のものは到達不可能と見なされリサイクルされる．
-    struct Obj* next; // 追跡用の Obj チェーン（リスト）における，次の Obj へのポインタ
+    uint64_t next : 48; // 追跡用の Obj チェーン（リスト）における，次の Obj へのポインタ
+    ObjType type : 8;
+    bool isYoung : 1; // 若い世代（まだ一度もGCを生き延びていない）オブジェクトかどうか．ref. 世代別GC
+    bool isRemembered : 1; // 記憶集合（vm.remembered）に登録済みかどうか．ref. 世代別GC
+    bool isInterned : 1; // インターン化済みの文字列かどうか．@note ObjString 専用（ヘッダの空きビットを使う）．ref. 遅延インターン化
+    bool isFieldName : 1; // インスタンスのフィールド名として使われたことがある文字列かどうか．@note ObjString 専用．ref. メソッドの仮想関数表
 };
 
+static inline Obj* objNext(Obj* object) {
+    return (Obj*)(uintptr_t)object->next;
+}
+
+static inline void setObjNext(Obj* object, Obj* next) {
+    object->next = (uintptr_t)next;
+}
+
 typedef struct {
     Obj obj; // オブジェクト型共通のデータ．@note 構造体継承：このフィールドを先頭に持ってくることで，ObjFunction* を Obj* に安全にキャストできる（先頭が完全に一致するため）．
     int arity; // その関数が受け取りたいパラメータの数
     int upvalueCount; // その関数がキャプチャした上位値の個数
     Chunk chunk; // 関数の本文を格納するチャンク
     ObjString* name; // 関数名（ランタイムエラー時などに利用する）
+    int profileId; // プロファイラが関数を識別するための通し番号．@note プロファイラが無効なら -1．ref. プロファイリング
+#ifdef DEBUG_COUNT_OPCODES
+    int countId; // 関数ごとの実行回数の表における通し番号．ref. 命令の実行回数
+#endif
 } ObjFunction;
 
 /**
@@ -68,13 +108,44 @@ typedef struct {
     NativeFn function; // ネイティブ関数（言語組み込みの関数）へのポインタ．
 } ObjNative;
 
+/**
+ * @note 遅延インターン化
+ *  実行時に作られる文字列（連結の結果など）の多くは，一度出力されたら捨てられる中間値なので，
+ *  作るたびにハッシュを計算してインターン化済みの文字列の表を引くのは無駄になる．
+ *  そこで，実行時に作った文字列はインターン化もハッシュの計算もせずに使い始め，
+ *  表のキーのように同一性やハッシュが必要になった時点で初めて internString() に通す．
+ *
+ *  インターン化されていない文字列が混ざるので，文字列の等値比較はポインタだけでは決まらず，
+ *  どちらかがインターン化されていなければ長さと中身を比べる．ref. stringsEqual()
+ *  なお，ソースコード中の識別子やリテラルはコンパイル時にインターン化されるので，プロパティ名などは常にポインタで比べられる．
+ */
 struct ObjString {
     Obj obj; // オブジェクト型共通のデータ．ref. 構造体継承
     int length; // 割り当てられたバイト数
-    char* chars; // 文字配列の先頭へのポインタ
-    uint32_t hash; // その文字列に対応するハッシュ（ハッシュ再計算を不要にするためにキャッシュとして保持）
+    uint32_t hash; // その文字列に対応するハッシュ（ハッシュ再計算を不要にするためにキャッシュとして保持）．@note インターン化するまでは計算しない（0 のまま）．
+    int methodSlot; // メソッド名としてのスロット番号．@note メソッド名として使われたことがなければ -1．ref. メソッドの仮想関数表
+    char chars[]; // 文字配列（ターミネータを含む）．@note フレキシブル配列メンバ：別の割り当てにせずオブジェクトの直後に置くことで，割り当てが1回で済み，参照時のポインタの間接参照も1段減る．
 };
 
+#define ROPE_MIN_LENGTH 64 // 連結の結果がこの文字数以上になる場合だけロープにする．@note 短い文字列は，その場で連結した方が速く，メモリも少なくて済む．
+
+/**
+ * @note ロープ
+ *  文字列の連結のたびに新しい文字配列を割り当ててコピーし，ハッシュを計算してインターン化すると，
+ *  ループの中で s = s + x のように文字列を組み立てる処理が，コピーとハッシュの両方で文字数の2乗に比例してしまう．
+ *  そこで，長い文字列の連結では，左右の文字列を指すだけのノード（ロープ）を作り，
+ *  実際の文字が必要になった時（等値比較など）に初めて1つの文字列に平坦化（flatten）してインターン化する．
+ *
+ *  Lox のユーザーからは，ロープは普通の文字列と区別できない．
+ */
+typedef struct {
+    Obj obj; // オブジェクト型共通のデータ．ref. 構造体継承
+    int length; // 連結した結果の文字数
+    Obj* left; // 左側の文字列（ObjString か ObjRope）．@note 平坦化した後は，回収できるように NULL にする．
+    Obj* right; // 右側の文字列（ObjString か ObjRope）．@note 同上．
+    ObjString* flat; // 平坦化した結果．@note まだ平坦化していない場合は NULL．
+} ObjRope;
+
 typedef struct ObjUpvalue {
     Obj obj; // オブジェクト型共通のデータ．ref. 構造体継承
     Value* location; // 閉じ込めた（クロージャ・キャプチャした）変数へのポインタ
@@ -89,14 +160,44 @@ typedef struct ObjUpvalue {
 typedef struct {
     Obj obj; // オブジェクト型共通のデータ．ref. 構造体継承
     ObjFunction* function;
-    ObjUpvalue** upvalues; // このクロージャがキャプチャしている上位値ポインタの配列．@note ダブルポインタ
     int upvalueCount; // このクロージャが保持する上位値の数．@note ObjFunction も upvalueCount を保持しているので，本来は不要だが，GCが ObjClousure の上位値配列サイズを知りたい場合があるので，あえて冗長性を持たせている．
+    ObjUpvalue* upvalues[]; // このクロージャがキャプチャしている上位値ポインタの配列．@note フレキシブル配列メンバとして，オブジェクトの直後に置く．
 } ObjClosure;
 
+/**
+ * @note メソッドの仮想関数表
+ *  メソッドを呼び出すたびにクラスのハッシュテーブルを名前で引くと，呼び出しのたびにハッシュ表の探索が必要になる．
+ *  そこで，メソッド名ごとにVM全体で一意なスロット番号を振り（vm.methodNames），
+ *  クラス本文の終わり（OP_END_CLASS）で，メソッドをスロット番号で引ける平坦な配列（vtable）に固める（封印する）．
+ *  スロット番号はインターン化されたメソッド名の文字列自身が持つので，呼び出し時は配列の添字アクセスだけで済む．
+ *
+ *  また，フィールドがメソッドを隠すかどうかの確認も，一度もフィールド名として使われていない名前（isFieldName）なら省略できる．
+ *
+ *  ただし，スロット番号はVM全体で振るので，メソッド名の種類が増えるほど，少数のメソッドしか持たないクラスの vtable も長くなる．
+ *  vtable がスカスカになる（スロット番号の上限に比べてメソッドが少ない）クラスでは，代わりにスロット番号をキーにした小さな開番地法のハッシュ表を使い，
+ *  クラス1つあたりのメモリをメソッド数に比例する量に抑える．
+ */
+
+/**
+ * スカスカなクラスのメソッド表（開番地法のハッシュ表）のエントリ
+ */
+typedef struct {
+    int slot; // スロット番号．@note 空きエントリは -1．
+    ObjClosure* method;
+} MethodEntry;
+
+#define VTABLE_MIN_SIZE 16 // スロット番号の上限がこれ以下なら，メソッドの数によらず平坦な vtable を使う．
+#define VTABLE_MAX_SPARSITY 4 // 平坦な vtable を使う，スロット番号の上限とメソッドの数の比の上限．@note これを超えるクラスはハッシュ表を使う．
+
 typedef struct {
     Obj obj; // オブジェクト型共通のデータ．ref. 構造体継承
     ObjString* name; // クラス名．実行時のスタックトレースなどで利用される．
-    Table methods; // クラスが所有するメソッド群のハッシュテーブル．
+    Table methods; // クラス本文で定義されたメソッド群のハッシュテーブル．@note 封印するまでの一時的な置き場で，封印した後は空になる．
+    ObjClosure** vtable; // スロット番号で引くメソッドの配列．@note そのクラスに無いメソッドのスロットは NULL．
+    int vtableCount; // vtable の要素数（そのクラスのメソッドのスロット番号の最大値 + 1）．@note スカスカなメソッド表を使うクラスでは 0．
+    MethodEntry* sparseMethods; // スロット番号をキーにしたメソッドのハッシュ表．@note vtable を使うクラスでは NULL．
+    int sparseCapacity; // sparseMethods の総容量（2の累乗）
+    ObjClosure* initializer; // 初期化メソッド init() のキャッシュ．@note 無ければ NULL．
 } ObjClass;
 
 typedef struct {
@@ -105,6 +206,53 @@ typedef struct {
     Table fields; // インスタンス固有のフィールドを保持するハッシュテーブル．@note Lox ユーザーは実行時にインスタンスにフィールドを追加できるので，拡張可能である必要があり，なおかつフィールドの検索を高速で行いたいのでハッシュテーブルを用いる．
 } ObjInstance;
 
+/**
+ * リスト（動的配列）
+ *
+ * @note 要素は連続した Value の配列に詰めて持つので，添字アクセスは定数時間で，順に辿る時もキャッシュに乗りやすい．
+ *       インスタンスのフィールド（ハッシュテーブル）で配列を模倣するのに比べて，ハッシュ計算も文字列キーの生成も要らない．
+ */
+typedef struct {
+    Obj obj; // オブジェクト型共通のデータ．ref. 構造体継承
+    ValueArray items; // 要素の配列．@warning 要素を書き換える時は，writeBarrier を通すこと．
+} ObjList;
+
+/**
+ * 型付き配列の要素の型
+ */
+typedef enum {
+    TYPED_FLOAT64, // double（Float64Array）
+    TYPED_INT32, // int32_t（Int32Array）
+} TypedArrayKind;
+
+/**
+ * 型付き配列
+ *
+ * @note 要素を NaN ボックス化した Value ではなく，生の double や int32_t の配列に詰めて持つ．
+ *       メモリの帯域を無駄にせず（Int32Array なら Value の半分），SIMD 命令でまとめて演算できる．ref. 型付き配列
+ *       要素はオブジェクトを参照しないので，GCが辿る必要もない．
+ */
+typedef struct {
+    Obj obj; // オブジェクト型共通のデータ．ref. 構造体継承
+    TypedArrayKind kind;
+    int length; // 要素数．@note 作成後に長さは変わらない．
+    void* data; // 要素の配列の先頭へのポインタ．@note 要素数が 0 の場合は NULL．
+} ObjTypedArray;
+
+static inline size_t typedArrayElementSize(TypedArrayKind kind) {
+    return kind == TYPED_FLOAT64 ? sizeof(double) : sizeof(int32_t);
+}
+
+/**
+ * マップ（連想配列）
+ *
+ * @note インスタンスのフィールドは静的に分かる識別子しかキーにできないので，実行時に決まる任意の値をキーにしたい場合に使う．
+ */
+typedef struct {
+    Obj obj; // オブジェクト型共通のデータ．ref. 構造体継承
+    Map table; // キーと値のハッシュ表．@warning エントリを書き換える時は，キーと値の両方について writeBarrier を通すこと．
+} ObjMap;
+
 /**
  * 束縛メソッド
  * 呼び出し元のインスタンスの状態をメソッドに紐づけるための構造体．
@@ -123,14 +271,43 @@ ObjClass* newClass(ObjString* name);
 ObjClosure* newClosure(ObjFunction* function);
 ObjFunction* newFunction();
 ObjInstance* newInstance(ObjClass* klass);
+ObjList* newList();
+ObjMap* newMap();
+
+/**
+ * 要素を 0 で初期化した型付き配列を作る．
+ */
+ObjTypedArray* newTypedArray(TypedArrayKind kind, int length);
 ObjNative* newNative(NativeFn function);
 
 /**
- * 渡された文字列をそのまま ObjString に割り当てる（所有する）．
+ * 2つの文字列（ObjString か ObjRope）を連結したロープを作る．ref. ロープ
+ *
+ * @warning left と right は，GCから到達可能な状態で渡すこと．
+ */
+ObjRope* newRope(Obj* left, Obj* right);
+
+/**
+ * ロープを平坦化した文字列を返す．@note 結果はロープにキャッシュされるので，2回目以降は何もしない．
+ * @note 結果の文字列はインターン化しない．ref. 遅延インターン化
+ */
+ObjString* flattenRope(ObjRope* rope);
+
+/**
+ * length 文字分の領域を持つ，中身が未初期化でインターン化もされていない ObjString を割り当てる．
+ *
+ * @note 連結のように，中身をその場で組み立てたい場合に使う．
+ *       chars を（ターミネータまで）埋めれば，インターン化しないまま値として使える．ref. 遅延インターン化
+ */
+ObjString* allocateString(int length);
+
+/**
+ * 文字列をインターン化する．@note 表のキーのように，同一性やハッシュが必要になった時に呼ぶ．ref. 遅延インターン化
  *
- * @note すでにヒープに割り当て済みの文字列に対して使う．
+ * @return 同じ内容の文字列がすでにインターン化されていればそのポインタ，そうでなければ渡された文字列自身．
+ * @note 前者の場合，呼び出し元が渡された文字列を使わなくなれば，GCに回収される．
  */
-ObjString* takeString(char* chars, int length);
+ObjString* internString(ObjString* string);
 
 /**
  * 渡された文字列をヒープ上にコピーして ObjString に割り当てる（所有しない）．
@@ -152,4 +329,52 @@ static inline bool isObjType(Value value, ObjType type) {
     return IS_OBJ(value) && AS_OBJ(value)->type == type;
 }
 
+/**
+ * @return true: 2つの文字列の中身が等しい．ref. 遅延インターン化
+ */
+static inline bool stringsEqual(ObjString* a, ObjString* b) {
+    if (a == b) return true;
+    if (a->obj.isInterned && b->obj.isInterned) return false; // インターン化済み同士なら，中身が同じなら必ず同じオブジェクト．
+    return a->length == b->length && memcmp(a->chars, b->chars, a->length) == 0;
+}
+
+/**
+ * @return 所与の名前のメソッド．@note 存在しなければ NULL．ref. メソッドの仮想関数表
+ */
+static inline ObjClosure* findMethod(ObjClass* klass, ObjString* name) {
+    int slot = name->methodSlot;
+    if (slot < 0) return NULL;
+    if (slot < klass->vtableCount) return klass->vtable[slot];
+    if (klass->sparseMethods == NULL) return NULL;
+
+    // 線形探針．@note 総容量はメソッド数の2倍以上あるので，空きエントリが必ずある．
+    int mask = klass->sparseCapacity - 1;
+    for (int index = slot & mask;; index = (index + 1) & mask) {
+        MethodEntry* entry = &klass->sparseMethods[index];
+        if (entry->slot == slot) return entry->method;
+        if (entry->slot < 0) return NULL;
+    }
+}
+
+/**
+ * @return true: Lox から見て文字列である値（ObjString か ObjRope）．ref. ロープ
+ */
+static inline bool isStringLike(Value value) {
+    return IS_STRING(value) || IS_ROPE(value);
+}
+
+/**
+ * @return 文字列（ObjString か ObjRope）の文字数．@note ロープを平坦化せずに求まる．
+ */
+static inline int stringLength(Obj* string) {
+    return string->type == OBJ_ROPE ? ((ObjRope*)string)->length : ((ObjString*)string)->length;
+}
+
+/**
+ * 文字列である値を ObjString として返す．@note ロープの場合は平坦化する（割り当てが発生しうる）．
+ */
+static inline ObjString* asString(Value value) {
+    return IS_ROPE(value) ? flattenRope(AS_ROPE(value)) : AS_STRING(value);
+}
+
 #endif
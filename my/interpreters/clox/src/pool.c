@@ -0,0 +1,328 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "pool.h"
+
+#define POOL_SMALL_CLASSES (POOL_SMALL_SIZE / POOL_GRANULE) // 刻み幅ごとのサイズクラスの数
+#define POOL_CLASS_COUNT (POOL_SMALL_CLASSES + 4 * 5) // @note 256 〜 8192 バイトの 5 つの区間を，それぞれ 4 つのサイズクラスに分ける．
+#define POOL_EVACUATE_OCCUPANCY 0.5 // コンパクションで，使用率がこれを下回るブロックを退避元にする．
+#define POOL_HEADER_SIZE ((sizeof(PoolBlock) + POOL_GRANULE - 1) & ~(size_t)(POOL_GRANULE - 1))
+#define POOL_LARGE_CLASS -1 // 大きなオブジェクト専用のブロックを表すサイズクラス
+#define POOL_PAGE_SIZE 4096
+#define POOL_CACHE_BYTES (1024 * 1024) // 空になったブロックを，OSに返さずに取っておく総バイト数の上限
+
+static PoolBlock* availableBlocks[POOL_KIND_COUNT][POOL_CLASS_COUNT]; // 種類・サイズクラスごとの，空きスロットを持つブロックのリストの先頭
+static PoolBlock* allBlocks[POOL_KIND_COUNT]; // 種類ごとの，全てのブロックのリストの先頭
+static size_t footprint[POOL_KIND_COUNT]; // 種類ごとの，確保済みのブロックの総バイト数
+static size_t liveBytes[POOL_KIND_COUNT]; // 種類ごとの，使用中のスロットの総バイト数
+static PoolBlock* cachedBlocks; // 空になって取っておいたブロックのリストの先頭．@note nextBlock で繋ぐ．
+static size_t cachedBytes; // 取っておいたブロックの総バイト数
+
+/**
+ * @note POOL_SMALL_SIZE までは刻み幅ごと，それより大きければ (2^k, 2^(k+1)] の区間を 4 等分した刻みでサイズクラスを分ける．
+ *       大きなサイズクラスの無駄は高々 25% に収まる．
+ */
+static int sizeClassOf(size_t size) {
+    if (size <= POOL_SMALL_SIZE) return (int)((size + POOL_GRANULE - 1) / POOL_GRANULE) - 1;
+
+    int log = 63 - __builtin_clzll(size - 1); // 2^log < size <= 2^(log+1)
+    size_t base = (size_t)1 << log;
+    int quarter = (int)((size - 1 - base) / (base / 4));
+    return POOL_SMALL_CLASSES + (log - 8) * 4 + quarter;
+}
+
+static int classSize(int sizeClass) {
+    if (sizeClass < POOL_SMALL_CLASSES) return (sizeClass + 1) * POOL_GRANULE;
+
+    int log = 8 + (sizeClass - POOL_SMALL_CLASSES) / 4;
+    int quarter = (sizeClass - POOL_SMALL_CLASSES) % 4;
+    return (1 << log) + (quarter + 1) * ((1 << log) / 4);
+}
+
+static void linkBlock(PoolBlock* block) {
+    PoolBlock** head = &availableBlocks[block->kind][block->sizeClass];
+    block->prev = NULL;
+    block->next = *head;
+    if (block->next != NULL) block->next->prev = block;
+    *head = block;
+    block->isAvailable = true;
+}
+
+static void unlinkBlock(PoolBlock* block) {
+    if (block->prev != NULL) {
+        block->prev->next = block->next;
+    } else {
+        availableBlocks[block->kind][block->sizeClass] = block->next;
+    }
+    if (block->next != NULL) block->next->prev = block->prev;
+    block->isAvailable = false;
+}
+
+/**
+ * 取っておいたブロックのうち，ちょうど size バイトのものをリストから外して返す．
+ *
+ * @return ブロックの先頭．@note 見つからなければ NULL．
+ */
+static char* takeCachedBlock(size_t size) {
+    PoolBlock** link = &cachedBlocks;
+    for (PoolBlock* block = cachedBlocks; block != NULL; block = block->nextBlock) {
+        if ((size_t)(block->end - (char*)block) == size) {
+            *link = block->nextBlock;
+            cachedBytes -= size;
+            return (char*)block;
+        }
+        link = &block->nextBlock;
+    }
+    return NULL;
+}
+
+/**
+ * POOL_BLOCK_SIZE でアラインされた size バイトのブロックを確保し，ヘッダを初期化する．
+ *
+ * @note 取っておいた同じサイズのブロックがあればそれを使い，無ければOSから確保する．
+ *       mmap はページ単位でしかアラインしないので，余分に確保してから前後の余りを返す．
+ */
+static PoolBlock* mapBlock(PoolKind kind, size_t size) {
+    char* start = takeCachedBlock(size);
+    if (start == NULL) {
+        char* raw = mmap(NULL, size + POOL_BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) return NULL;
+
+        start = (char*)(((uintptr_t)raw + POOL_BLOCK_SIZE - 1) & ~(uintptr_t)(POOL_BLOCK_SIZE - 1));
+        if (start > raw) munmap(raw, start - raw);
+        munmap(start + size, raw + POOL_BLOCK_SIZE - start);
+    }
+
+    PoolBlock* block = (PoolBlock*)start;
+    block->freeList = NULL;
+    block->bump = start + POOL_HEADER_SIZE;
+    block->end = start + size;
+    block->kind = kind;
+    block->liveCount = 0;
+    block->isAvailable = false;
+    block->isEvacuating = false;
+    memset(block->marks, 0, sizeof(block->marks));
+
+    block->prevBlock = NULL;
+    block->nextBlock = allBlocks[kind];
+    if (block->nextBlock != NULL) block->nextBlock->prevBlock = block;
+    allBlocks[kind] = block;
+    footprint[kind] += size;
+
+    return block;
+}
+
+static PoolBlock* newBlock(PoolKind kind, int sizeClass) {
+    PoolBlock* block = mapBlock(kind, POOL_BLOCK_SIZE);
+    if (block == NULL) return NULL;
+
+    block->sizeClass = sizeClass;
+    block->slotSize = classSize(sizeClass);
+    linkBlock(block);
+    return block;
+}
+
+/**
+ * POOL_MAX_SIZE を超える Obj を，それ専用のブロックに割り当てる．
+ *
+ * @note 大きなオブジェクトもブロックの先頭にヘッダを持たせることで，マークビットマップなどを小さなオブジェクトと同じように扱える．
+ *       コンパクションでは移動しない．
+ */
+static void* allocateLarge(PoolKind kind, size_t size) {
+    size_t blockSize = (POOL_HEADER_SIZE + size + POOL_PAGE_SIZE - 1) & ~(size_t)(POOL_PAGE_SIZE - 1);
+    PoolBlock* block = mapBlock(kind, blockSize);
+    if (block == NULL) return NULL;
+
+    block->sizeClass = POOL_LARGE_CLASS;
+    block->slotSize = (int)size;
+    block->liveCount = 1;
+    liveBytes[kind] += size;
+    return block->bump;
+}
+
+/**
+ * ブロックを手放す．@note 取っておくブロックの総量が上限に収まる間はOSに返さず，次のブロックの確保に使い回す．
+ *
+ * @warning 空きスロットを持つブロックのリストからは，事前に外しておく．
+ */
+static void releaseBlock(PoolBlock* block) {
+    if (block->prevBlock != NULL) {
+        block->prevBlock->nextBlock = block->nextBlock;
+    } else {
+        allBlocks[block->kind] = block->nextBlock;
+    }
+    if (block->nextBlock != NULL) block->nextBlock->prevBlock = block->prevBlock;
+
+    size_t size = block->end - (char*)block;
+    footprint[block->kind] -= size;
+    liveBytes[block->kind] -= (size_t)block->liveCount * block->slotSize;
+
+    if (cachedBytes + size <= POOL_CACHE_BYTES) {
+        block->nextBlock = cachedBlocks;
+        cachedBlocks = block;
+        cachedBytes += size;
+        return;
+    }
+    munmap(block, size);
+}
+
+static void* allocateSlot(PoolKind kind, int sizeClass) {
+    PoolBlock* block = availableBlocks[kind][sizeClass];
+    if (block == NULL) {
+        block = newBlock(kind, sizeClass);
+        if (block == NULL) return NULL;
+    }
+
+    void* slot;
+    if (block->freeList != NULL) {
+        slot = block->freeList;
+        block->freeList = *(void**)slot;
+    } else {
+        slot = block->bump;
+        block->bump += block->slotSize;
+    }
+    block->liveCount++;
+    liveBytes[kind] += block->slotSize;
+
+    // 満杯になったブロックはリストから外し，次回以降の割り当てで探索しないようにする．
+    if (block->freeList == NULL && block->bump + block->slotSize > block->end) {
+        unlinkBlock(block);
+    }
+
+    return slot;
+}
+
+static void freeSlot(void* slot) {
+    PoolBlock* block = poolBlockOf(slot);
+
+    if (block->sizeClass == POOL_LARGE_CLASS) {
+        releaseBlock(block);
+        return;
+    }
+
+    // 空きスロットは常に未マークにしておき，次にそこへ割り当てたオブジェクトがマーク済みに見えないようにする．
+    size_t index = ((char*)slot - (char*)block) / POOL_GRANULE;
+    block->marks[index / 64] &= ~((uint64_t)1 << (index % 64));
+
+    *(void**)slot = block->freeList;
+    block->freeList = slot;
+    block->liveCount--;
+    liveBytes[block->kind] -= block->slotSize;
+
+    if (block->isEvacuating) return; // 退避元のブロックは，コンパクションの最後にまとめて返す．
+    if (!block->isAvailable) linkBlock(block);
+
+    // 空になったブロックは手放す．@note 割り当てと解放を繰り返すたびにブロックを出し入れしないよう，各サイズクラスの最後の1ブロックだけは残しておく．
+    if (block->liveCount == 0 && (block->prev != NULL || block->next != NULL)) {
+        unlinkBlock(block);
+        releaseBlock(block);
+    }
+}
+
+static void* allocateMemory(PoolKind kind, size_t size) {
+    if (size <= POOL_MAX_SIZE) return allocateSlot(kind, sizeClassOf(size));
+    if (kind == POOL_OBJECT) return allocateLarge(kind, size);
+    return malloc(size);
+}
+
+static void freeMemory(PoolKind kind, void* pointer, size_t size) {
+    if (pointer == NULL) return;
+
+    if (size <= POOL_MAX_SIZE || kind == POOL_OBJECT) {
+        freeSlot(pointer);
+    } else {
+        free(pointer);
+    }
+}
+
+void* poolReallocate(PoolKind kind, void* pointer, size_t oldSize, size_t newSize) {
+    if (newSize == 0) {
+        freeMemory(kind, pointer, oldSize);
+        return NULL;
+    }
+
+    if (pointer == NULL) return allocateMemory(kind, newSize);
+
+    // 同じサイズクラスに収まる場合は，そのままのスロットを使い続けられる．
+    if (oldSize <= POOL_MAX_SIZE && newSize <= POOL_MAX_SIZE) {
+        if (sizeClassOf(oldSize) == sizeClassOf(newSize)) return pointer;
+    } else if (kind == POOL_ARRAY && oldSize > POOL_MAX_SIZE && newSize > POOL_MAX_SIZE) {
+        return realloc(pointer, newSize);
+    }
+
+    void* result = allocateMemory(kind, newSize);
+    if (result == NULL) return NULL;
+
+    memcpy(result, pointer, oldSize < newSize ? oldSize : newSize);
+    freeMemory(kind, pointer, oldSize);
+    return result;
+}
+
+double poolFragmentation(PoolKind kind) {
+    size_t footprint = poolFootprint(kind);
+    if (footprint == 0) return 0.0;
+    return 1.0 - (double)liveBytes[kind] / (double)footprint;
+}
+
+size_t poolFootprint(PoolKind kind) {
+    return footprint[kind];
+}
+
+void poolClearMarks(PoolKind kind) {
+    for (PoolBlock* block = allBlocks[kind]; block != NULL; block = block->nextBlock) {
+        memset(block->marks, 0, sizeof(block->marks));
+    }
+}
+
+bool poolBeginEvacuation(PoolKind kind) {
+    bool found = false;
+
+    for (PoolBlock* block = allBlocks[kind]; block != NULL; block = block->nextBlock) {
+        if (block->sizeClass == POOL_LARGE_CLASS) continue;
+
+        size_t capacity = (POOL_BLOCK_SIZE - POOL_HEADER_SIZE) / block->slotSize;
+        if (block->liveCount >= capacity * POOL_EVACUATE_OCCUPANCY) continue;
+
+        // 退避先として使われないように，空きスロットを持つブロックのリストから外しておく．
+        if (block->isAvailable) unlinkBlock(block);
+        block->isEvacuating = true;
+        found = true;
+    }
+
+    return found;
+}
+
+bool poolIsEvacuating(void* pointer) {
+    return poolBlockOf(pointer)->isEvacuating;
+}
+
+void poolEndEvacuation(PoolKind kind) {
+    PoolBlock* block = allBlocks[kind];
+    while (block != NULL) {
+        PoolBlock* next = block->nextBlock;
+        if (block->isEvacuating) releaseBlock(block);
+        block = next;
+    }
+}
+
+void freePools() {
+    for (int kind = 0; kind < POOL_KIND_COUNT; kind++) {
+        PoolBlock* block = allBlocks[kind];
+        while (block != NULL) {
+            PoolBlock* next = block->nextBlock;
+            if (block->liveCount == 0) {
+                if (block->isAvailable) unlinkBlock(block);
+                releaseBlock(block);
+            }
+            block = next;
+        }
+    }
+
+    while (cachedBlocks != NULL) {
+        PoolBlock* next = cachedBlocks->nextBlock;
+        munmap(cachedBlocks, cachedBlocks->end - (char*)cachedBlocks);
+        cachedBlocks = next;
+    }
+    cachedBytes = 0;
+}
@@ -0,0 +1,141 @@
+#ifndef clox_pool_h
+#define clox_pool_h
+
+#include "common.h"
+
+#define POOL_SMALL_SIZE 256 // 刻み幅ごとのサイズクラスで割り当てる最大のサイズ（バイト）．@note これより大きいサイズクラスは，2の累乗の区間を 4 等分した刻みにする．
+#define POOL_MAX_SIZE 8192 // プールから割り当てる最大のサイズ（バイト）．@note これより大きい割り当ては，配列ならシステムの realloc に任せ，Obj ならそれ専用のブロックを確保する．
+#define POOL_BLOCK_SIZE (64 * 1024) // OSから一度に確保するブロックのサイズ．@warning ブロックはこのサイズでアラインされるので，2の累乗でなければならない．
+#define POOL_GRANULE 16 // サイズクラスの刻み幅．@note スロットのアラインメントも兼ねる．
+#define POOL_MARK_WORDS (POOL_BLOCK_SIZE / POOL_GRANULE / 64) // マークビットマップの語数（刻み幅ごとに1ビット）
+
+/**
+ * @note サイズクラス別のプールアロケータ
+ *  clox の割り当ての大半は，ObjUpvalue や ObjBoundMethod，小さなエントリ配列のような数十バイトの小さなもの．
+ *  それらを一つずつシステムの malloc に任せると，ロックやメタデータのコストがかかるうえ，オブジェクトがヒープ上に散らばる．
+ *  そこで，OSから大きなブロックをまとめて確保し，同じサイズクラスのスロットに切り分けて，サイズクラスごとの空きリストで使い回す．
+ *
+ *  reallocate には常に正確な元のサイズが渡されるので，スロットごとにサイズのメタデータを持つ必要はない．
+ *
+ *  インライン化した長い文字列のような数百バイト〜数キロバイトの割り当ても，サイズクラスを粗くしたプールから割り当てる．
+ *  また，空になったブロックは一定量までOSに返さずに取っておき，次のブロックの確保に使い回す．
+ *  どちらも，割り当てと解放のたびに mmap / munmap のシステムコールを呼ばないようにするため．
+ */
+
+/**
+ * プールの種類．@note オブジェクトと配列のスロットを同じブロックに混在させると，
+ *       オブジェクトを退避させてもブロックが空にならないので，ブロックを分けておく．ref. コンパクション
+ */
+typedef enum {
+    POOL_ARRAY, // 動的配列や文字列の文字配列（移動できない）
+    POOL_OBJECT, // Obj とその派生型（コンパクションで移動できる）
+    POOL_KIND_COUNT,
+} PoolKind;
+
+/**
+ * OSから確保した1つのブロック．@note ブロックの先頭に置かれ，残りの領域を同じサイズのスロットに切り分ける．
+ *
+ * @note ブロックは POOL_BLOCK_SIZE でアラインされているので，
+ *       スロットのアドレスの下位ビットを落とすだけで，所属するブロックが分かる．
+ */
+typedef struct PoolBlock {
+    struct PoolBlock* prev;
+    struct PoolBlock* next; // 同じサイズクラスで，空きスロットを持つブロックの双方向リスト
+    struct PoolBlock* prevBlock;
+    struct PoolBlock* nextBlock; // 同じ種類の全てのブロックの双方向リスト（満杯のものも含む）
+    void* freeList; // 解放済みスロットの連結リスト．@note 次のスロットへのポインタを，空きスロット自身の先頭に埋め込む．
+    char* bump; // まだ一度も切り出していない領域の先頭．@note ブロックを確保した時点で全スロットを空きリストに繋ぐのではなく，必要になった時に切り出す．
+    char* end; // ブロックの末尾
+    PoolKind kind;
+    int sizeClass;
+    int slotSize;
+    int liveCount; // 使用中のスロット数
+    bool isAvailable; // 空きスロットを持ち，サイズクラスのリストに繋がっているかどうか
+    bool isEvacuating; // コンパクションの退避元かどうか
+
+    /**
+     * GCのマークビットマップ．ブロック内の刻み幅ごとに1ビット．ref. サイドテーブル方式のマーク
+     *
+     * @note マークをオブジェクトのヘッダではなくここに置くことで，マーキングとスイープが
+     *       生きているオブジェクトのページに書き込まなくなり（キャッシュを汚さず，fork 後のコピーオンライトも起きない），
+     *       マークのクリアも memset 一回で済む．
+     */
+    uint64_t marks[POOL_MARK_WORDS];
+} PoolBlock;
+
+static inline PoolBlock* poolBlockOf(void* slot) {
+    return (PoolBlock*)((uintptr_t)slot & ~(uintptr_t)(POOL_BLOCK_SIZE - 1));
+}
+
+/**
+ * @return true: 所与のスロットがマーク済み．@warning プールから割り当てたポインタにしか使えない．
+ */
+static inline bool poolIsMarked(void* slot) {
+    size_t index = ((uintptr_t)slot & (POOL_BLOCK_SIZE - 1)) / POOL_GRANULE;
+    return (poolBlockOf(slot)->marks[index / 64] >> (index % 64)) & 1;
+}
+
+/**
+ * 所与のスロットをマークする．
+ *
+ * @param atomic true: 複数のスレッドから同時に呼ばれうる（並列マーキング中）．
+ * @return true: 既にマーク済みだった．
+ */
+static inline bool poolMark(void* slot, bool atomic) {
+    size_t index = ((uintptr_t)slot & (POOL_BLOCK_SIZE - 1)) / POOL_GRANULE;
+    uint64_t* word = &poolBlockOf(slot)->marks[index / 64];
+    uint64_t bit = (uint64_t)1 << (index % 64);
+
+    if (atomic) return (__atomic_fetch_or(word, bit, __ATOMIC_RELAXED) & bit) != 0;
+
+    bool wasMarked = (*word & bit) != 0;
+    *word |= bit;
+    return wasMarked;
+}
+
+/**
+ * 所与の種類の全てのブロックのマークビットマップをクリアする．
+ */
+void poolClearMarks(PoolKind kind);
+
+/**
+ * reallocate と同じ規約で，メモリを割り当て／拡張／縮小／解放する．
+ *
+ * @param kind 割り当て元のプールの種類．@warning 解放する時も，割り当てた時と同じ種類を渡す．
+ * @return 新しい領域へのポインタ．@note newSize が 0 の場合，または割り当てに失敗した場合は NULL．
+ */
+void* poolReallocate(PoolKind kind, void* pointer, size_t oldSize, size_t newSize);
+
+/**
+ * @return 所与の種類のプールの断片化率（確保済みのブロックのうち，使われていない割合）．0.0 〜 1.0
+ */
+double poolFragmentation(PoolKind kind);
+
+/**
+ * @return 所与の種類のプールが確保しているブロックの総バイト数．
+ */
+size_t poolFootprint(PoolKind kind);
+
+/**
+ * 使用率の低いブロックを退避元として選び，以降の割り当てに使われないようにする．
+ *
+ * @return true: 退避元のブロックが1つ以上ある．
+ */
+bool poolBeginEvacuation(PoolKind kind);
+
+/**
+ * @return true: 所与のスロットが退避元のブロックにある．@warning プールから割り当てたポインタにしか使えない．
+ */
+bool poolIsEvacuating(void* pointer);
+
+/**
+ * 退避元のブロックを（中身ごと）手放す．@warning 全ての生きているスロットの退避と，それらへの参照の更新が済んでから呼ぶ．
+ */
+void poolEndEvacuation(PoolKind kind);
+
+/**
+ * 使われていないブロックを全てOSに返す．
+ */
+void freePools();
+
+#endif
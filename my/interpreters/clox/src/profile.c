@@ -0,0 +1,338 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "profile.h"
+#include "vm.h"
+
+#define PROFILE_MAX_STACKS 4096 // 記録できる異なるスタックの数（2 の冪乗）．@note 占有率 3/4 を超えたら，新しいスタックのサンプルは捨てる．
+#define PROFILE_MAX_FRAMES (1 << 18) // 記録できるフレームの総数（全スタックの深さの合計）
+#define PROFILE_REPORT_ROWS 20 // フラットな集計で出力する行数の上限
+
+// 関数ではない疑似フレームの通し番号．@note 関数の通し番号はこの後ろから振る．
+#define SYMBOL_GC 0
+#define SYMBOL_COMPACTION 1
+
+typedef struct {
+    int symbol; // 関数の通し番号
+    int line; // @note 疑似フレームでは 0
+} ProfileFrame;
+
+/**
+ * 同じコールスタックのサンプルをまとめたもの．
+ */
+typedef struct {
+    uint32_t hash;
+    int depth; // @note 0 なら空きスロット．
+    int offset; // フレームの配列（frames）の中での，根元のフレームの位置
+    uint64_t count; // サンプル数
+} ProfileStack;
+
+volatile sig_atomic_t profilePhase = PROFILE_MUTATOR;
+bool profiling = false;
+
+// @note 以下の表はシグナルハンドラが書き込むので，サンプリング中は（シグナルハンドラ以外から）触らない．
+static ProfileStack* stacks = NULL;
+static ProfileFrame* frames = NULL;
+static int stackCount = 0;
+static int frameCount = 0;
+static uint64_t droppedCount = 0;
+
+// @note 関数の名前の表はメインスレッドのコンパイラだけが触る（シグナルハンドラは通し番号しか使わない）．
+static char** symbols = NULL;
+static int symbolCount = 0;
+static int symbolCapacity = 0;
+
+static const char* foldedPath = NULL;
+static int sampleInterval = PROFILE_DEFAULT_INTERVAL;
+
+static uint32_t hashFrames(const ProfileFrame* stack, int depth) {
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (int i = 0; i < depth; i++) {
+        hash = (hash ^ (uint32_t)stack[i].symbol) * 16777619u;
+        hash = (hash ^ (uint32_t)stack[i].line) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @warning シグナルハンドラから呼ぶので，非同期シグナル安全な処理しか行わない（割り当てはしない）．
+ */
+static void recordSample(const ProfileFrame* stack, int depth) {
+    uint32_t hash = hashFrames(stack, depth);
+    uint32_t index = hash & (PROFILE_MAX_STACKS - 1);
+
+    for (;;) {
+        ProfileStack* entry = &stacks[index];
+
+        if (entry->depth == 0) {
+            if (stackCount + 1 > PROFILE_MAX_STACKS * 3 / 4 || frameCount + depth > PROFILE_MAX_FRAMES) {
+                droppedCount++;
+                return;
+            }
+            memcpy(&frames[frameCount], stack, sizeof(ProfileFrame) * depth);
+            entry->hash = hash;
+            entry->offset = frameCount;
+            entry->count = 1;
+            entry->depth = depth;
+            frameCount += depth;
+            stackCount++;
+            return;
+        }
+
+        if (
+            entry->hash == hash && entry->depth == depth &&
+            memcmp(&frames[entry->offset], stack, sizeof(ProfileFrame) * depth) == 0
+        ) {
+            entry->count++;
+            return;
+        }
+
+        index = (index + 1) & (PROFILE_MAX_STACKS - 1); // 線形探針
+    }
+}
+
+/**
+ * SIGPROF のシグナルハンドラ．その瞬間のコールスタックを根元から順に記録する．
+ *
+ * @note コールフレームは，初期化し終えてから frameCount を増やすので（ref. call），[0, frameCount) のフレームは常に読める．
+ */
+static void sample(int signal) {
+    (void)signal;
+    ProfileFrame stack[FRAMES_MAX + 1];
+    int depth = 0;
+
+    if (profilePhase == PROFILE_COMPACTING) {
+        stack[depth++] = (ProfileFrame){SYMBOL_COMPACTION, 0};
+    } else {
+        int count = vm.frameCount;
+        for (int i = 0; i < count; i++) {
+            CallFrame* frame = &vm.frames[i];
+            ObjFunction* function = frame->closure->function;
+            ptrdiff_t instruction = frame->ip - function->chunk.code;
+            if (instruction > 0) instruction--; // ip は次の命令を指している．ref. runtimeError
+
+            stack[depth++] = (ProfileFrame){function->profileId, function->chunk.lines[instruction]};
+        }
+        if (profilePhase == PROFILE_GC) stack[depth++] = (ProfileFrame){SYMBOL_GC, 0};
+    }
+
+    if (depth == 0) return; // Lox のコードを実行していない（コンパイル中など）．
+    recordSample(stack, depth);
+}
+
+static int addSymbol(const char* name) {
+    if (symbolCount == symbolCapacity) {
+        symbolCapacity = symbolCapacity < 64 ? 64 : symbolCapacity * 2;
+        symbols = (char**)realloc(symbols, sizeof(char*) * symbolCapacity);
+        if (symbols == NULL) exit(1); // アロケーションの失敗．
+    }
+
+    size_t length = strlen(name);
+    char* copy = (char*)malloc(length + 1);
+    if (copy == NULL) exit(1);
+    memcpy(copy, name, length + 1);
+
+    symbols[symbolCount] = copy;
+    return symbolCount++;
+}
+
+bool startProfiler(const char* path, int interval) {
+    stacks = (ProfileStack*)calloc(PROFILE_MAX_STACKS, sizeof(ProfileStack));
+    frames = (ProfileFrame*)malloc(sizeof(ProfileFrame) * PROFILE_MAX_FRAMES);
+    if (stacks == NULL || frames == NULL) return false;
+
+    addSymbol("[gc]");
+    addSymbol("[compaction]");
+    foldedPath = path;
+    sampleInterval = interval;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = sample;
+    action.sa_flags = SA_RESTART; // 読み込みなどのシステムコールがサンプリングで中断されないようにする．
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, NULL) != 0) return false;
+
+    // @note ITIMER_PROF はプロセスのCPU時間（ユーザー＋カーネル）で進むので，待ち時間はサンプリングされない．
+    struct itimerval timer;
+    timer.it_interval.tv_sec = interval / 1000000;
+    timer.it_interval.tv_usec = interval % 1000000;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, NULL) != 0) return false;
+
+    profiling = true;
+    return true;
+}
+
+void profileFunction(ObjFunction* function) {
+    if (!profiling) return;
+    function->profileId = addSymbol(function->name != NULL ? function->name->chars : "script");
+}
+
+static void stopProfiler() {
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    signal(SIGPROF, SIG_IGN); // 停止前に発生して保留中のシグナルを捨てる．
+}
+
+static const char* symbolName(int symbol) {
+    return symbol >= 0 && symbol < symbolCount ? symbols[symbol] : "?";
+}
+
+/**
+ * フレームを "関数名:行" の形式で書き出す．@note 疑似フレームは名前だけ．
+ */
+static void formatFrame(char* buffer, size_t size, ProfileFrame frame) {
+    if (frame.line == 0) {
+        snprintf(buffer, size, "%s", symbolName(frame.symbol));
+    } else {
+        snprintf(buffer, size, "%s:%d", symbolName(frame.symbol), frame.line);
+    }
+}
+
+/**
+ * 関数または行ごとの集計
+ */
+typedef struct {
+    ProfileFrame frame; // @note 関数ごとの集計では line は 0
+    int stack; // 集計中のスタックの番号．@note 再帰で同じスタックに何度も現れても，total には1回だけ数える．
+    uint64_t self; // スタックの先端にいたサンプル数
+    uint64_t total; // スタックのどこかにいたサンプル数
+} ProfileRow;
+
+static int compareFrames(const void* a, const void* b) {
+    const ProfileFrame* left = (const ProfileFrame*)a;
+    const ProfileFrame* right = (const ProfileFrame*)b;
+    if (left->symbol != right->symbol) return left->symbol < right->symbol ? -1 : 1;
+    if (left->line != right->line) return left->line < right->line ? -1 : 1;
+    return 0;
+}
+
+static int compareRows(const void* a, const void* b) {
+    const ProfileRow* left = (const ProfileRow*)a;
+    const ProfileRow* right = (const ProfileRow*)b;
+    if (left->self != right->self) return left->self > right->self ? -1 : 1;
+    if (left->total != right->total) return left->total > right->total ? -1 : 1;
+    return compareFrames(&left->frame, &right->frame);
+}
+
+/**
+ * 全スタックのフレームを集計する．
+ *
+ * @param byLine true: 関数と行の組ごと, false: 関数ごと
+ * @return 集計の配列（self の降順）．@note 呼び出し側で free する．
+ */
+static ProfileRow* aggregate(bool byLine, int* rowCount) {
+    // @note 異なる（関数，行）の組は，記録したフレームの総数を超えない．
+    ProfileRow* rows = (ProfileRow*)malloc(sizeof(ProfileRow) * (frameCount > 0 ? frameCount : 1));
+    if (rows == NULL) exit(1);
+
+    // 全フレームの（関数，行）を並べて重複を除き，集計先の行を作る．
+    int count = 0;
+    for (int i = 0; i < frameCount; i++) {
+        rows[count].frame = frames[i];
+        if (!byLine) rows[count].frame.line = 0;
+        count++;
+    }
+    qsort(rows, count, sizeof(ProfileRow), compareFrames); // @note frame は先頭のフィールドなので，そのまま比較できる．
+
+    int unique = 0;
+    for (int i = 0; i < count; i++) {
+        if (unique > 0 && compareFrames(&rows[unique - 1].frame, &rows[i].frame) == 0) continue;
+        rows[unique].frame = rows[i].frame;
+        rows[unique].stack = -1;
+        rows[unique].self = 0;
+        rows[unique].total = 0;
+        unique++;
+    }
+
+    for (int i = 0; i < PROFILE_MAX_STACKS; i++) {
+        ProfileStack* entry = &stacks[i];
+        if (entry->depth == 0) continue;
+
+        for (int j = 0; j < entry->depth; j++) {
+            ProfileFrame frame = frames[entry->offset + j];
+            if (!byLine) frame.line = 0;
+
+            ProfileRow* row = (ProfileRow*)bsearch(&frame, rows, unique, sizeof(ProfileRow), compareFrames);
+            if (row->stack != i) {
+                row->stack = i;
+                row->total += entry->count;
+            }
+            if (j == entry->depth - 1) row->self += entry->count;
+        }
+    }
+
+    qsort(rows, unique, sizeof(ProfileRow), compareRows);
+    *rowCount = unique;
+    return rows;
+}
+
+static void printRows(FILE* out, const char* title, bool byLine, uint64_t recorded) {
+    int rowCount;
+    ProfileRow* rows = aggregate(byLine, &rowCount);
+
+    fprintf(out, "%-32s %7s %8s %7s %8s\n", title, "self%", "self", "total%", "total");
+    for (int i = 0; i < rowCount && i < PROFILE_REPORT_ROWS; i++) {
+        char name[256];
+        formatFrame(name, sizeof(name), rows[i].frame);
+        fprintf(out, "  %-30s %6.1f%% %8llu %6.1f%% %8llu\n", name,
+            100.0 * rows[i].self / recorded, (unsigned long long)rows[i].self,
+            100.0 * rows[i].total / recorded, (unsigned long long)rows[i].total
+        );
+    }
+    if (rowCount > PROFILE_REPORT_ROWS) fprintf(out, "  ... %d more\n", rowCount - PROFILE_REPORT_ROWS);
+
+    free(rows);
+}
+
+/**
+ * フレームグラフ用の畳み込みスタックを出力する．@note 1行が1スタックで，根元から ; 区切りでフレームを並べ，最後にサンプル数を置く．
+ */
+static bool writeFolded(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) return false;
+
+    for (int i = 0; i < PROFILE_MAX_STACKS; i++) {
+        ProfileStack* entry = &stacks[i];
+        if (entry->depth == 0) continue;
+
+        for (int j = 0; j < entry->depth; j++) {
+            char name[256];
+            formatFrame(name, sizeof(name), frames[entry->offset + j]);
+            if (j > 0) fputc(';', file);
+            fputs(name, file);
+        }
+        fprintf(file, " %llu\n", (unsigned long long)entry->count);
+    }
+
+    return fclose(file) == 0;
+}
+
+void printProfile(FILE* out) {
+    if (!profiling) return;
+    profiling = false;
+    stopProfiler();
+
+    uint64_t recorded = 0;
+    for (int i = 0; i < PROFILE_MAX_STACKS; i++) {
+        recorded += stacks[i].count;
+    }
+
+    fprintf(out, "== profile ==\n");
+    fprintf(out, "samples         %llu recorded, %llu dropped, interval %d us\n",
+        (unsigned long long)recorded, (unsigned long long)droppedCount, sampleInterval
+    );
+    if (recorded > 0) {
+        printRows(out, "functions", false, recorded);
+        printRows(out, "lines", true, recorded);
+    }
+
+    if (!writeFolded(foldedPath)) {
+        fprintf(out, "Could not write folded stacks to \"%s\".\n", foldedPath);
+    } else {
+        fprintf(out, "folded stacks   %s\n", foldedPath);
+    }
+}
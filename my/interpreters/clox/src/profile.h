@@ -0,0 +1,55 @@
+#ifndef clox_profile_h
+#define clox_profile_h
+
+#include <signal.h>
+#include <stdio.h>
+
+#include "common.h"
+#include "object.h"
+
+/**
+ * @note サンプリングプロファイラ．ref. プロファイリング
+ *  CPU時間のタイマー（ITIMER_PROF）で一定間隔ごとに SIGPROF を受け取り，その瞬間の Lox のコールスタック（各フレームの関数と行）を記録する．
+ *  シグナルハンドラの中では malloc などが使えないので，関数は名前ではなく通し番号で記録し，同じスタックは事前に確保した表の上で数え上げるだけにする．
+ *  終了時に，関数・行ごとのフラットな集計と，フレームグラフ用の畳み込みスタック（folded stacks）を出力する．
+ *  有効にしていなければ何もしないし，有効にしていても1サンプルあたりスタックを1回辿るだけなので，常時有効にしておける程度の負荷で済む．
+ *
+ * @note SIGPROF を受け取るのはメインスレッドだけ（GCのマーキングスレッドではシグナルをブロックする）．
+ * @warning 行番号は，シグナルが届いた時点の ip から求めるので，実行中の命令の前後にずれることがある．
+ * @warning 実際のサンプリング間隔は，カーネルのタイマーの刻み（数ミリ秒）より細かくはならない．
+ */
+
+#define PROFILE_DEFAULT_INTERVAL 1000 // サンプリング間隔（マイクロ秒）の既定値
+
+/**
+ * シグナルハンドラにヒープの状態を伝えるためのフラグ．@note GCが切り替える．
+ */
+typedef enum {
+    PROFILE_MUTATOR, // ミューテータの実行中
+    PROFILE_GC, // GCの停止中．@note オブジェクトは動かないので，スタックを辿れる．
+    PROFILE_COMPACTING, // コンパクションの途中．@warning オブジェクトが移動中なので，スタックを辿れない．
+} ProfilePhase;
+
+extern volatile sig_atomic_t profilePhase;
+extern bool profiling; // プロファイラが有効かどうか．
+
+/**
+ * プロファイラを有効にして，サンプリングを開始する．
+ *
+ * @param foldedPath 畳み込みスタックの出力先のファイルパス
+ * @param interval サンプリング間隔（マイクロ秒）
+ * @return false: タイマーやシグナルハンドラの設定に失敗した．
+ */
+bool startProfiler(const char* foldedPath, int interval);
+
+/**
+ * コンパイルし終えた関数に通し番号を振り，その名前を記録する．@note プロファイラが無効なら何もしない．
+ */
+void profileFunction(ObjFunction* function);
+
+/**
+ * サンプリングを止めて，フラットな集計を out に，畳み込みスタックをファイルに出力する．@note 2回目以降の呼び出しでは何もしない．
+ */
+void printProfile(FILE* out);
+
+#endif
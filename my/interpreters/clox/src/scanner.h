@@ -7,7 +7,10 @@ typedef enum {
     TOKEN_RIGHT_PAREN, // `)`
     TOKEN_LEFT_BRACE, // `{`
     TOKEN_RIGHT_BRACE, // `}`
+    TOKEN_LEFT_BRACKET, // `[`
+    TOKEN_RIGHT_BRACKET, // `]`
     TOKEN_COMMA, // `,`
+    TOKEN_COLON, // `:`
     TOKEN_DOT, // `.`
     TOKEN_MINUS, // ```-`
     TOKEN_PLUS, // `+`
@@ -6,12 +6,377 @@
 #include "table.h"
 #include "value.h"
 
-#define TABLE_MAX_LOAD 0.75 // ハッシュ表の最大許容占有率（衝突を避けるために 1 未満で調整する）
+#if defined(SWISS_TABLE) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 void initTable(Table* table) {
     table->count = 0;
     table->capacity = 0;
     table->entries = NULL;
+#ifdef SWISS_TABLE
+    table->control = NULL;
+#endif
+}
+
+#define TABLE_MIN_LOAD 0.25 // これを下回ったらハッシュ表を縮める占有率．@note 拡張と縮小を繰り返さないよう，最大許容占有率より十分低くする．
+#define TABLE_SHRINK_LOAD 0.5 // 縮めた後の占有率の上限
+#define TABLE_MIN_CAPACITY 8 // 縮める時の総容量の下限（GROW_CAPACITY の最小値）
+
+/**
+ * @return true: 生きているエントリが live 個の表は，縮めるべき（占有率が下限を下回った）．
+ */
+static inline bool shouldShrink(Table* table, int live) {
+    return table->capacity > TABLE_MIN_CAPACITY && live < table->capacity * TABLE_MIN_LOAD;
+}
+
+static void shrinkTable(Table* table, int live);
+
+#ifdef SWISS_TABLE
+
+#define TABLE_MAX_LOAD 0.875 // ハッシュ表の最大許容占有率．@note 制御バイトでまとめて探索できるので，線形探針よりも高くできる．
+#define TABLE_EMPTY 0x80 // 空きスロットの制御バイト．@note 使用中のスロットの制御バイトはハッシュの上位 7 ビット（0 〜 127）なので，最上位ビットだけで空きを見分けられる．
+
+/**
+ * @note グループ単位の探索
+ *  制御バイトを TABLE_GROUP_WIDTH 個まとめて読み込み，
+ *  「探しているハッシュの上位 7 ビットと一致するスロット」と「空きスロット」をそれぞれビットマスクとして求める．
+ *  SSE2 が使える環境では 16 バイトを1命令で比較し，使えない環境では 8 バイトを 64 ビット整数として比較する（SWAR）．
+ */
+#ifdef __SSE2__
+
+#define TABLE_GROUP_WIDTH 16
+
+typedef uint32_t GroupMask; // 1 スロットにつき 1 ビット
+
+static inline GroupMask matchControl(const uint8_t* control, uint8_t byte) {
+    __m128i group = _mm_loadu_si128((const __m128i*)control);
+    return (GroupMask)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)byte)));
+}
+
+static inline GroupMask matchEmpty(const uint8_t* control) {
+    return (GroupMask)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)control)); // 最上位ビットが立っているのは空きスロットだけ．
+}
+
+static inline int firstSlot(GroupMask mask) {
+    return __builtin_ctz(mask);
+}
+
+#else
+
+#define TABLE_GROUP_WIDTH 8
+#define GROUP_LOW_BITS 0x0101010101010101ull
+#define GROUP_HIGH_BITS 0x8080808080808080ull
+
+typedef uint64_t GroupMask; // 1 スロットにつき，そのバイトの最上位ビット
+
+static inline uint64_t loadGroup(const uint8_t* control) {
+    uint64_t group;
+    memcpy(&group, control, sizeof(group));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    group = __builtin_bswap64(group); // 先頭のスロットを下位のバイトにそろえる．
+#endif
+    return group;
+}
+
+/**
+ * @note 0 になったバイトを探す定番のビット演算．一致したバイトより上位のバイトが誤って一致と判定されることがあるが，
+ *       候補のスロットは必ずキーを比べて確かめるので問題ない．
+ */
+static inline GroupMask matchControl(const uint8_t* control, uint8_t byte) {
+    uint64_t x = loadGroup(control) ^ (GROUP_LOW_BITS * byte);
+    return (x - GROUP_LOW_BITS) & ~x & GROUP_HIGH_BITS;
+}
+
+static inline GroupMask matchEmpty(const uint8_t* control) {
+    return loadGroup(control) & GROUP_HIGH_BITS;
+}
+
+static inline int firstSlot(GroupMask mask) {
+    return __builtin_ctzll(mask) >> 3;
+}
+
+#endif
+
+/**
+ * @return 制御バイトに記録するハッシュの上位 7 ビット．@note 下位のビットはスロットの位置を決めるのに使うので，上位のビットを使う．
+ */
+static inline uint8_t controlHash(uint32_t hash) {
+    return (uint8_t)(hash >> 25);
+}
+
+/**
+ * @return capacity 個のスロットを持つ表の，エントリ配列と制御バイト配列を合わせたバイト数．
+ * @note 表の末尾をまたぐグループも1回で読めるように，制御バイトは先頭の TABLE_GROUP_WIDTH 個分の複製を末尾に持つ．
+ */
+static size_t tableBytes(int capacity) {
+    return sizeof(Entry) * capacity + capacity + TABLE_GROUP_WIDTH;
+}
+
+/**
+ * スロットの制御バイトを書き換える．@note 末尾の複製も合わせて書き換える（総容量がグループより小さい場合は複製が複数ある）．
+ */
+static void setControl(Table* table, int index, uint8_t byte) {
+    table->control[index] = byte;
+    for (int mirror = index + table->capacity; mirror < table->capacity + TABLE_GROUP_WIDTH; mirror += table->capacity) {
+        table->control[mirror] = byte;
+    }
+}
+
+void freeTable(Table* table) {
+    FREE_ARRAY(uint8_t, (uint8_t*)table->entries, table->capacity == 0 ? 0 : tableBytes(table->capacity));
+    initTable(table);
+}
+
+/**
+ * @param found 所与のキーが見つかったかどうかの書き込み先．
+ * @return 所与のキーのスロットの位置．@note キーが存在しない場合は，そのキーを追加すべき空きスロットの位置．
+ *
+ * @note 探索の順序は線形探針と同じ（ホーム位置から1スロットずつ後ろへ）で，それをグループ単位でまとめて調べる．
+ *       線形探針では，キーはホーム位置から空きスロットまでの間にしか存在しないので，空きスロットを含むグループで探索を打ち切れる．
+ * @warning 占有率が 100% にならないように capacity が調整されることを前提としている（空きがないと無限ループになる）．
+ */
+static uint32_t findSlot(Table* table, ObjString* key, bool* found) {
+    uint32_t mask = table->capacity - 1;
+    uint32_t position = key->hash & mask;
+
+    // 大半のキーはホーム位置にあるか，ホーム位置が空いているので，グループを読み込む前にそこだけ直接調べる．
+    *found = table->entries[position].key == key;
+    if (*found || table->control[position] == TABLE_EMPTY) return position;
+
+    uint8_t hash = controlHash(key->hash);
+    for (;;) {
+        const uint8_t* group = &table->control[position];
+        for (GroupMask match = matchControl(group, hash); match != 0; match &= match - 1) {
+            uint32_t index = (position + firstSlot(match)) & mask;
+            if (table->entries[index].key == key) {
+                *found = true;
+                return index;
+            }
+        }
+
+        GroupMask empty = matchEmpty(group);
+        if (empty != 0) return (position + firstSlot(empty)) & mask;
+
+        position = (position + TABLE_GROUP_WIDTH) & mask;
+    }
+}
+
+/**
+ * @return 所与のハッシュのホーム位置から数えて，最初の空きスロットの位置．
+ * @warning 占有率が 100% にならないように capacity が調整されることを前提としている（空きがないと無限ループになる）．
+ */
+static uint32_t findEmptySlot(Table* table, uint32_t hash) {
+    uint32_t mask = table->capacity - 1;
+    uint32_t position = hash & mask;
+
+    for (;;) {
+        GroupMask empty = matchEmpty(&table->control[position]);
+        if (empty != 0) return (position + firstSlot(empty)) & mask;
+
+        position = (position + TABLE_GROUP_WIDTH) & mask;
+    }
+}
+
+static void insertEntry(Table* table, uint32_t index, ObjString* key, Value value) {
+    table->entries[index].key = key;
+    table->entries[index].value = value;
+    setControl(table, index, controlHash(key->hash));
+    table->count++;
+}
+
+/**
+ * 表にまだ存在しないことが分かっているキーを追加する．@note キーを比べる必要がないので，空きスロットだけを探せばよい．
+ */
+static void reinsertEntry(Table* table, ObjString* key, Value value) {
+    insertEntry(table, findEmptySlot(table, key->hash), key, value);
+}
+
+/**
+ * 全てのスロットを空にする．@note 制御バイトの配列の位置も，entries と capacity から求め直す．
+ */
+static void clearSlots(Table* table) {
+    table->control = (uint8_t*)(table->entries + table->capacity);
+    for (int i = 0; i < table->capacity; i++) {
+        table->entries[i].key = NULL;
+        table->entries[i].value = NIL_VAL;
+    }
+    memset(table->control, TABLE_EMPTY, table->capacity + TABLE_GROUP_WIDTH);
+}
+
+bool tableGet(Table* table, ObjString* key, Value* value) {
+    if (table->count == 0) return false;
+
+    bool found;
+    uint32_t index = findSlot(table, key, &found);
+    if (!found) return false;
+
+    *value = table->entries[index].value;
+    return true;
+}
+
+/**
+ * capacity 個のスロットを持つ配列を用意し，既存のエントリを全て再記入する．
+ */
+static void adjustCapacity(Table* table, int capacity) {
+    Table resized;
+    resized.count = 0;
+    resized.capacity = capacity;
+    resized.entries = (Entry*)ALLOCATE(uint8_t, tableBytes(capacity));
+    clearSlots(&resized);
+
+    for (int i = 0; i < table->capacity; i++) {
+        Entry* entry = &table->entries[i];
+        if (entry->key != NULL) reinsertEntry(&resized, entry->key, entry->value);
+    }
+
+    freeTable(table);
+    *table = resized;
+}
+
+bool tableSet(Table* table, ObjString* key, Value value) {
+    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
+        adjustCapacity(table, GROW_CAPACITY(table->capacity));
+    }
+
+    bool found;
+    uint32_t index = findSlot(table, key, &found);
+    if (found) {
+        table->entries[index].value = value;
+        return false;
+    }
+
+    insertEntry(table, index, key, value);
+    return true;
+}
+
+/**
+ * スロットを空け，後続のエントリを詰め直す（後方シフト削除）．
+ *
+ * @note 墓標を立てる代わりに，空けたスロットより後ろにあって，ホーム位置からの探索でそのスロットを通過するエントリを前に詰める．
+ *       これで「キーはホーム位置から空きスロットまでの間にある」という線形探針の前提が保たれるので，墓標が要らない．
+ */
+static void removeSlot(Table* table, uint32_t index) {
+    uint32_t mask = table->capacity - 1;
+    uint32_t hole = index;
+
+    for (uint32_t next = (hole + 1) & mask; table->control[next] != TABLE_EMPTY; next = (next + 1) & mask) {
+        uint32_t home = table->entries[next].key->hash & mask;
+
+        // ホーム位置から next までの距離が，空いたスロットから next までの距離以上なら，空いたスロットに詰められる．
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            table->entries[hole] = table->entries[next];
+            setControl(table, hole, table->control[next]);
+            hole = next;
+        }
+    }
+
+    table->entries[hole].key = NULL;
+    table->entries[hole].value = NIL_VAL;
+    setControl(table, hole, TABLE_EMPTY);
+    table->count--;
+}
+
+bool tableDelete(Table* table, ObjString* key) {
+    if (table->count == 0) return false;
+
+    bool found;
+    uint32_t index = findSlot(table, key, &found);
+    if (!found) return false;
+
+    removeSlot(table, index);
+    if (shouldShrink(table, table->count)) shrinkTable(table, table->count);
+    return true;
+}
+
+ObjString* tableFindString(
+    Table* table,
+    const char* chars,
+    int length,
+    uint32_t hash
+) {
+    if (table->count == 0) return NULL;
+
+    uint32_t mask = table->capacity - 1;
+    uint8_t controlByte = controlHash(hash);
+    uint32_t position = hash & mask;
+
+    for (;;) {
+        const uint8_t* group = &table->control[position];
+        for (GroupMask match = matchControl(group, controlByte); match != 0; match &= match - 1) {
+            ObjString* key = table->entries[(position + firstSlot(match)) & mask].key;
+            if (
+                key->length == length
+                && key->hash == hash
+                && memcmp(key->chars, chars, length) == 0
+            ) {
+                return key;
+            }
+        }
+        if (matchEmpty(group) != 0) return NULL;
+
+        position = (position + TABLE_GROUP_WIDTH) & mask;
+    }
+}
+
+/**
+ * @note GCは弱参照の表から一度に大量のエントリを削除するので，1つずつ後方シフトで詰めるのではなく，
+ *       まず全ての白いエントリを空け，その後に残ったエントリをまとめて詰め直す．
+ */
+void tableRemoveWhite(Table* table) {
+    if (table->count == 0) return;
+
+    uint32_t mask = table->capacity - 1;
+
+    // 削除する前から空いているスロットは，どのキーの探索範囲（ホーム位置から実際の位置まで）にも含まれないので，そこを詰め直しの起点にする．
+    uint32_t start = 0;
+    while (table->control[start] != TABLE_EMPTY) start++;
+
+    int removed = 0;
+    for (int i = 0; i < table->capacity; i++) {
+        Entry* entry = &table->entries[i];
+        if (entry->key != NULL && isWhite((Obj*)entry->key)) {
+            entry->key = NULL;
+            entry->value = NIL_VAL;
+            setControl(table, i, TABLE_EMPTY);
+            removed++;
+        }
+    }
+    if (removed == 0) return;
+    table->count -= removed;
+
+    // 縮める場合は全てのエントリを挿入し直すので，詰め直しは要らない．
+    if (shouldShrink(table, table->count)) {
+        shrinkTable(table, table->count);
+        return;
+    }
+
+    // 起点から順に，各エントリをホーム位置から最初の空きスロットまで前に詰める．@note 詰めたエントリより前に新しい空きができることはない．
+    for (uint32_t i = (start + 1) & mask; i != start; i = (i + 1) & mask) {
+        Entry* entry = &table->entries[i];
+        if (entry->key == NULL) continue;
+
+        uint32_t home = entry->key->hash & mask;
+        uint32_t slot = findEmptySlot(table, entry->key->hash);
+        if (((slot - home) & mask) < ((i - home) & mask)) {
+            table->entries[slot] = *entry;
+            setControl(table, slot, table->control[i]);
+            entry->key = NULL;
+            entry->value = NIL_VAL;
+            setControl(table, i, TABLE_EMPTY);
+        }
+    }
+}
+
+#else
+
+#define TABLE_MAX_LOAD 0.75 // ハッシュ表の最大許容占有率（衝突を避けるために 1 未満で調整する）
+
+/**
+ * @return capacity 個のエントリを持つ配列のバイト数．
+ */
+static size_t tableBytes(int capacity) {
+    return sizeof(Entry) * capacity;
 }
 
 void freeTable(Table* table) {
@@ -74,6 +439,26 @@ static Entry* findEntry(
     }
 }
 
+/**
+ * 表にまだ存在しないことが分かっているキーを追加する．@warning 墓標のない表にしか使えない．
+ */
+static void reinsertEntry(Table* table, ObjString* key, Value value) {
+    Entry* dest = findEntry(table->entries, table->capacity, key);
+    dest->key = key;
+    dest->value = value;
+    table->count++;
+}
+
+/**
+ * 全てのエントリを空エントリにする．
+ */
+static void clearSlots(Table* table) {
+    for (int i = 0; i < table->capacity; i++) {
+        table->entries[i].key = NULL;
+        table->entries[i].value = NIL_VAL;
+    }
+}
+
 bool tableGet(Table* table, ObjString* key, Value* value) {
     if (table->count == 0) return false;
 
@@ -157,15 +542,6 @@ bool tableDelete(Table* table, ObjString* key) {
     return true;
 }
 
-void tableAddAll(Table* from, Table* to) {
-    for (int i = 0; i < from->capacity; i++) {
-        Entry* entry = &from->entries[i];
-        if (entry->key != NULL) {
-            tableSet(to, entry->key, entry->value);
-        }
-    }
-}
-
 ObjString* tableFindString(
     Table* table,
     const char* chars,
@@ -200,10 +576,64 @@ ObjString* tableFindString(
 }
 
 void tableRemoveWhite(Table* table) {
+    int live = 0; // 生きているエントリ数（墓標を含まない）
+
     for (int i = 0; i < table->capacity; i++) {
         Entry* entry = &table->entries[i];
-        if (entry->key != NULL && !entry->key->obj.isMarked) {
+        if (entry->key == NULL) continue;
+
+        if (isWhite((Obj*)entry->key)) {
             tableDelete(table, entry->key);
+        } else {
+            live++;
+        }
+    }
+
+    // 占有率が下がった場合や，墓標が生きているエントリより多くなった場合は，墓標を捨てて詰め直す．
+    if (shouldShrink(table, live) || table->count - live > live) shrinkTable(table, live);
+}
+
+#endif
+
+/**
+ * 生きているエントリが live 個の表を，占有率に見合う総容量まで縮めて（墓標がある場合は同じ総容量のままでも）詰め直す．
+ *
+ * @note GCの途中（弱参照の表の掃除）からも呼ばれるので，GCを誘発しうる割り当ては行わない．
+ *       エントリを一旦GCの管理外のバッファに退避し，配列を縮めて（縮小はGCを誘発しない），そこへ挿入し直す．
+ */
+static void shrinkTable(Table* table, int live) {
+    if (live == 0) {
+        freeTable(table);
+        return;
+    }
+
+    int capacity = table->capacity;
+    while (capacity > TABLE_MIN_CAPACITY && live <= capacity / 2 * TABLE_SHRINK_LOAD) capacity /= 2;
+
+    Entry* saved = (Entry*)malloc(sizeof(Entry) * live);
+    if (saved == NULL) return; // 縮めなくても表としては正しいので，諦める．
+
+    int count = 0;
+    for (int i = 0; i < table->capacity; i++) {
+        if (table->entries[i].key != NULL) saved[count++] = table->entries[i];
+    }
+
+    table->entries = (Entry*)reallocate(table->entries, tableBytes(table->capacity), tableBytes(capacity));
+    table->capacity = capacity;
+    table->count = 0;
+    clearSlots(table);
+
+    for (int i = 0; i < count; i++) {
+        reinsertEntry(table, saved[i].key, saved[i].value);
+    }
+    free(saved);
+}
+
+void tableAddAll(Table* from, Table* to) {
+    for (int i = 0; i < from->capacity; i++) {
+        Entry* entry = &from->entries[i];
+        if (entry->key != NULL) {
+            tableSet(to, entry->key, entry->value);
         }
     }
 }
@@ -17,9 +17,12 @@ typedef struct {
  * @note count / capacity = ハッシュ表の占有率
  */
 typedef struct {
-    int count; // 要素数（利用済みの容量）＋墓標数
+    int count; // 要素数（利用済みの容量）＋墓標数．@note スイステーブルには墓標がないので，要素数のみ．
     int capacity; // 総容量
-    Entry* entries; // エントリの配列の先頭要素へのポインタ
+    Entry* entries; // エントリの配列の先頭要素へのポインタ．@note 空きスロットのエントリは，キーが NULL で値が nil．
+#ifdef SWISS_TABLE
+    uint8_t* control; // スロットごとの制御バイトの配列．ref. スイステーブル @note entries と同じ割り当ての末尾にある．
+#endif
 } Table;
 
 void initTable(Table* table);
@@ -14,15 +14,16 @@ void initValueArray(ValueArray* array) {
 
 void writeValueArray(ValueArray* array, Value value) {
     // 容量が足りない場合は，より大きな配列に値をコピーし，参照を移す
+    // NOTE: 割り当てはメモリ不足で途中から抜け出すことがあるので（ref. ヒープの上限），配列を広げ終えてから総容量を更新する．
     if (array->capacity < array->count + 1) {
-        int oldCapacity = array->capacity;
-        array->capacity = GROW_CAPACITY(oldCapacity);
+        int capacity = GROW_CAPACITY(array->capacity);
         array->values = GROW_ARRAY(
             Value,
             array->values,
-            oldCapacity,
-            array->capacity
+            array->capacity,
+            capacity
         );
+        array->capacity = capacity;
     }
 
     array->values[array->count] = value;
@@ -55,7 +56,27 @@ void printValue(Value value) {
 #endif
 }
 
+/**
+ * Lox から見て文字列である2つの値（ObjString か ObjRope）を比べる．
+ *
+ * @note 文字列はインターン化されているとは限らないので，ポインタだけでは比べられない．ref. 遅延インターン化
+ */
+static bool stringValuesEqual(Value a, Value b) {
+    if (AS_OBJ(a) == AS_OBJ(b)) return true;
+    if (IS_STRING(a) && IS_STRING(b)) return stringsEqual(AS_STRING(a), AS_STRING(b));
+    if (stringLength(AS_OBJ(a)) != stringLength(AS_OBJ(b))) return false; // 長さが違えば，ロープを平坦化するまでもない．ref. ロープ
+
+    push(a); // GC が勝手にメモリを開放しないように一旦VMのスタックにプッシュする．
+    push(b);
+    bool equal = stringsEqual(asString(a), asString(b));
+    pop();
+    pop();
+    return equal;
+}
+
 bool valuesEqual(Value a, Value b) {
+    if (isStringLike(a) && isStringLike(b)) return stringValuesEqual(a, b);
+
 #ifdef NAN_BOXING
     if (IS_NUMBER(a) && IS_NUMBER(b)) {
         // @warning: NaN == NaN だけはビット表現が一致していても false として扱う必要がある．
@@ -69,7 +90,7 @@ bool valuesEqual(Value a, Value b) {
         case VAL_BOOL: return AS_BOOL(a) == AS_BOOL(b);
         case VAL_NIL: return true; // 型が同じで nil なら必ず等しい．
         case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
-        case VAL_OBJ: return AS_OBJ(a) == AS_OBJ(b); // NOTE: 文字列はインターン化されているので，ポインタが等しければ必ず等しい．
+        case VAL_OBJ: return AS_OBJ(a) == AS_OBJ(b); // NOTE: 文字列同士は上で比べ済みなので，ここではポインタが等しいかどうかだけ見ればよい．
         default: return false;
     }
 #endif
@@ -1,11 +1,14 @@
 #include <stdarg.h>
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "common.h"
 #include "compiler.h"
 #include "debug.h"
+#include "kernel.h"
 #include "object.h"
 #include "memory.h"
 #include "vm.h"
@@ -17,6 +20,421 @@ static Value clockNative(int argCount, Value* args) {
     return NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
 }
 
+/**
+ * GCの統計値を取り出す．ref. GCテレメトリ
+ *
+ * @note e.g. gcStat("pauseMaxMs") 統計の名前が無効な場合は nil を返す．
+ */
+static Value gcStatNative(int argCount, Value* args) {
+    if (argCount != 1 || !isStringLike(args[0])) return NIL_VAL;
+
+    double value;
+    if (!gcStat(asString(args[0])->chars, &value)) return NIL_VAL;
+    return NUMBER_VAL(value);
+}
+
+/**
+ * @return リストやマップの要素数，または文字列の長さ．@note それ以外の値が渡された場合は nil を返す．
+ */
+static Value lengthNative(int argCount, Value* args) {
+    if (argCount != 1) return NIL_VAL;
+    if (IS_LIST(args[0])) return NUMBER_VAL(AS_LIST(args[0])->items.count);
+    if (IS_MAP(args[0])) return NUMBER_VAL(AS_MAP(args[0])->table.liveCount);
+    if (IS_TYPED_ARRAY(args[0])) return NUMBER_VAL(AS_TYPED_ARRAY(args[0])->length);
+    if (isStringLike(args[0])) return NUMBER_VAL(stringLength(AS_OBJ(args[0])));
+    return NIL_VAL;
+}
+
+/**
+ * リストの末尾に要素を追加する．@note e.g. push(list, 1, 2, 3) 複数の要素をまとめて追加できる．
+ *
+ * @return 追加後の要素数．@note リスト以外が渡された場合は nil を返す．
+ */
+static Value pushNative(int argCount, Value* args) {
+    if (argCount < 1 || !IS_LIST(args[0])) return NIL_VAL;
+
+    ObjList* list = AS_LIST(args[0]);
+    ValueArray* items = &list->items;
+    int count = argCount - 1;
+
+    // 一度に必要な容量まで広げておく．@note 要素はVMのスタック上にあるので，ここでGCが走っても回収されない．
+    if (items->capacity < items->count + count) {
+        int oldCapacity = items->capacity;
+        int capacity = oldCapacity;
+        while (capacity < items->count + count) capacity = GROW_CAPACITY(capacity);
+        items->values = GROW_ARRAY(Value, items->values, oldCapacity, capacity);
+        items->capacity = capacity;
+    }
+
+    for (int i = 1; i < argCount; i++) {
+        writeBarrier((Obj*)list, args[i]);
+        items->values[items->count++] = args[i];
+    }
+    return NUMBER_VAL(items->count);
+}
+
+/**
+ * @return リストの末尾から取り除いた要素．@note 空のリストやリスト以外が渡された場合は nil を返す．
+ */
+static Value popNative(int argCount, Value* args) {
+    if (argCount != 1 || !IS_LIST(args[0])) return NIL_VAL;
+
+    ValueArray* items = &AS_LIST(args[0])->items;
+    if (items->count == 0) return NIL_VAL;
+    return items->values[--items->count];
+}
+
+/**
+ * slice の範囲の端を，リストの両端に切り詰めた添字に変換する．
+ *
+ * @return false: 整数でない（NaN を含む）．
+ */
+static bool sliceBound(Value value, int count, int* result) {
+    if (!IS_NUMBER(value)) return false;
+
+    double number = AS_NUMBER(value);
+    // NOTE: NaN はどの比較も偽になって切り詰めをすり抜けるので，整数かどうかを先に確かめる．
+    //       また，切り詰めてから int に変換しないと，巨大な数値で未定義動作になる．
+    if (number != trunc(number)) return false;
+    *result = number < 0 ? 0 : number > count ? count : (int)number;
+    return true;
+}
+
+/**
+ * @return リストの [start, end) の範囲をコピーした新しいリスト．@note e.g. slice(list, 1) end を省略すると末尾まで．
+ *         範囲はリストの両端に切り詰める．リスト以外や，整数以外の範囲が渡された場合は nil を返す．
+ */
+static Value sliceNative(int argCount, Value* args) {
+    if (argCount < 2 || argCount > 3 || !IS_LIST(args[0])) return NIL_VAL;
+
+    ObjList* source = AS_LIST(args[0]);
+    int count = source->items.count;
+    int start;
+    int end = count;
+    if (!sliceBound(args[1], count, &start)) return NIL_VAL;
+    if (argCount == 3 && !sliceBound(args[2], count, &end)) return NIL_VAL;
+    if (end < start) end = start;
+
+    ObjList* list = newList();
+    push(OBJ_VAL(list)); // GC が勝手にメモリを開放しないように一旦VMのスタックにプッシュする．
+    int length = end - start;
+    if (length > 0) {
+        list->items.values = GROW_ARRAY(Value, NULL, 0, length);
+        list->items.capacity = length;
+        // @note 要素の確保でGCが走ると，新しいリストが古い世代に昇格していることがあるので，バリアは確保の後に通す．
+        for (int i = 0; i < length; i++) writeBarrier((Obj*)list, source->items.values[start + i]);
+        memcpy(list->items.values, source->items.values + start, sizeof(Value) * length);
+        list->items.count = length;
+    }
+    pop();
+    return OBJ_VAL(list);
+}
+
+/**
+ * マップのキーか値を集めた新しいリストを作る．
+ *
+ * @param keys true: キーを集める, false: 値を集める
+ */
+static Value mapEntriesNative(int argCount, Value* args, bool keys) {
+    if (argCount != 1 || !IS_MAP(args[0])) return NIL_VAL;
+
+    ObjList* list = newList();
+    push(OBJ_VAL(list)); // GC が勝手にメモリを開放しないように一旦VMのスタックにプッシュする．
+    Map* table = &AS_MAP(args[0])->table;
+    if (table->liveCount > 0) {
+        list->items.values = GROW_ARRAY(Value, NULL, 0, table->liveCount);
+        list->items.capacity = table->liveCount;
+    }
+
+    for (int i = 0; i < table->capacity; i++) {
+        MapEntry* entry = &table->entries[i];
+        if (IS_NIL(entry->key)) continue;
+
+        Value value = keys ? entry->key : entry->value;
+        writeBarrier((Obj*)list, value);
+        list->items.values[list->items.count++] = value;
+    }
+    pop();
+    return OBJ_VAL(list);
+}
+
+/**
+ * @return マップのキーを集めたリスト．@note 順序はハッシュ表の格納順．マップ以外が渡された場合は nil を返す．
+ */
+static Value keysNative(int argCount, Value* args) {
+    return mapEntriesNative(argCount, args, true);
+}
+
+/**
+ * @return マップの値を集めたリスト．@note 順序は keys() と対応する．マップ以外が渡された場合は nil を返す．
+ */
+static Value valuesNative(int argCount, Value* args) {
+    return mapEntriesNative(argCount, args, false);
+}
+
+/**
+ * @return true: マップが所与のキーを持つ．@note マップ以外や，キーにできない値が渡された場合は false を返す．
+ */
+static Value hasNative(int argCount, Value* args) {
+    if (argCount != 2 || !IS_MAP(args[0])) return BOOL_VAL(false);
+
+    Value key = args[1];
+    Value value;
+    if (!mapKey(&key, false)) return BOOL_VAL(false);
+    return BOOL_VAL(mapGet(&AS_MAP(args[0])->table, key, &value));
+}
+
+/**
+ * マップから所与のキーのエントリを取り除く．
+ *
+ * @return true: 取り除いた, false: 存在しなかった．@note マップ以外や，キーにできない値が渡された場合も false を返す．
+ */
+static Value removeNative(int argCount, Value* args) {
+    if (argCount != 2 || !IS_MAP(args[0])) return BOOL_VAL(false);
+
+    Value key = args[1];
+    if (!mapKey(&key, false)) return BOOL_VAL(false);
+    return BOOL_VAL(mapDelete(&AS_MAP(args[0])->table, key));
+}
+
+/**
+ * @return true: 所与の値が int32_t で表せる整数で，その値を result に格納した．
+ */
+static bool toInt32(Value value, int32_t* result) {
+    if (!IS_NUMBER(value)) return false;
+
+    double number = AS_NUMBER(value);
+    // NOTE: 範囲を先に確かめてから変換しないと，範囲外の数値や NaN で未定義動作になる．
+    if (!(number >= INT32_MIN && number <= INT32_MAX) || number != (int32_t)number) return false;
+    *result = (int32_t)number;
+    return true;
+}
+
+/**
+ * 型付き配列を作る．@note e.g. Float64Array(1024) 要素を 0 で埋めた配列，Float64Array([1, 2, 3]) リストの要素をコピーした配列．
+ *
+ * @return 長さが負や非整数の場合や，リストに要素の型で表せない値が含まれる場合は nil．
+ */
+static Value newTypedArrayNative(int argCount, Value* args, TypedArrayKind kind) {
+    if (argCount != 1) return NIL_VAL;
+
+    if (IS_NUMBER(args[0])) {
+        int32_t length;
+        if (!toInt32(args[0], &length) || length < 0) return NIL_VAL;
+        return OBJ_VAL(newTypedArray(kind, length));
+    }
+
+    if (!IS_LIST(args[0])) return NIL_VAL;
+
+    ValueArray* items = &AS_LIST(args[0])->items;
+    for (int i = 0; i < items->count; i++) {
+        int32_t element;
+        if (kind == TYPED_FLOAT64 ? !IS_NUMBER(items->values[i]) : !toInt32(items->values[i], &element)) return NIL_VAL;
+    }
+
+    ObjTypedArray* array = newTypedArray(kind, items->count); // @note リストは引数としてスタック上にあるので，ここでGCが走っても回収されない．
+    for (int i = 0; i < items->count; i++) {
+        if (kind == TYPED_FLOAT64) {
+            ((double*)array->data)[i] = AS_NUMBER(items->values[i]);
+        } else {
+            ((int32_t*)array->data)[i] = (int32_t)AS_NUMBER(items->values[i]);
+        }
+    }
+    return OBJ_VAL(array);
+}
+
+static Value float64ArrayNative(int argCount, Value* args) {
+    return newTypedArrayNative(argCount, args, TYPED_FLOAT64);
+}
+
+static Value int32ArrayNative(int argCount, Value* args) {
+    return newTypedArrayNative(argCount, args, TYPED_INT32);
+}
+
+/**
+ * @return true: 所与の値が全て，同じ要素の型と長さを持つ型付き配列．
+ */
+static bool sameShape(int count, Value* arrays) {
+    if (!IS_TYPED_ARRAY(arrays[0])) return false;
+
+    ObjTypedArray* first = AS_TYPED_ARRAY(arrays[0]);
+    for (int i = 1; i < count; i++) {
+        if (!IS_TYPED_ARRAY(arrays[i])) return false;
+        ObjTypedArray* array = AS_TYPED_ARRAY(arrays[i]);
+        if (array->kind != first->kind || array->length != first->length) return false;
+    }
+    return true;
+}
+
+#define FLOAT64_DATA(value) ((double*)AS_TYPED_ARRAY(value)->data)
+#define INT32_DATA(value) ((int32_t*)AS_TYPED_ARRAY(value)->data)
+
+/**
+ * 型付き配列の一括演算．ref. 型付き配列
+ *  出力先の配列を第1引数に取り，結果を書き込んでから，その配列を返す．@note 結果のための新しい配列は作らない．
+ *  出力先は入力と同じ配列でもよい．e.g. arrayAdd(a, a, b) は a に b を足し込む．
+ *  配列の要素の型と長さが揃っていない場合は，何もせずに nil を返す．
+ */
+
+/**
+ * arrayAdd(dst, a, b): dst = a + b
+ */
+static Value arrayAddNative(int argCount, Value* args) {
+    if (argCount != 3 || !sameShape(3, args)) return NIL_VAL;
+
+    int length = AS_TYPED_ARRAY(args[0])->length;
+    if (AS_TYPED_ARRAY(args[0])->kind == TYPED_FLOAT64) {
+        float64Kernels.add(FLOAT64_DATA(args[0]), FLOAT64_DATA(args[1]), FLOAT64_DATA(args[2]), length);
+    } else {
+        int32Add(INT32_DATA(args[0]), INT32_DATA(args[1]), INT32_DATA(args[2]), length);
+    }
+    return args[0];
+}
+
+/**
+ * arrayMul(dst, a, b): dst = a * b
+ */
+static Value arrayMulNative(int argCount, Value* args) {
+    if (argCount != 3 || !sameShape(3, args)) return NIL_VAL;
+
+    int length = AS_TYPED_ARRAY(args[0])->length;
+    if (AS_TYPED_ARRAY(args[0])->kind == TYPED_FLOAT64) {
+        float64Kernels.mul(FLOAT64_DATA(args[0]), FLOAT64_DATA(args[1]), FLOAT64_DATA(args[2]), length);
+    } else {
+        int32Mul(INT32_DATA(args[0]), INT32_DATA(args[1]), INT32_DATA(args[2]), length);
+    }
+    return args[0];
+}
+
+/**
+ * arrayFma(dst, a, b, c): dst = a * b + c
+ */
+static Value arrayFmaNative(int argCount, Value* args) {
+    if (argCount != 4 || !sameShape(4, args)) return NIL_VAL;
+
+    int length = AS_TYPED_ARRAY(args[0])->length;
+    if (AS_TYPED_ARRAY(args[0])->kind == TYPED_FLOAT64) {
+        float64Kernels.fma(FLOAT64_DATA(args[0]), FLOAT64_DATA(args[1]), FLOAT64_DATA(args[2]), FLOAT64_DATA(args[3]), length);
+    } else {
+        int32Fma(INT32_DATA(args[0]), INT32_DATA(args[1]), INT32_DATA(args[2]), INT32_DATA(args[3]), length);
+    }
+    return args[0];
+}
+
+/**
+ * 配列の全ての要素に定数を掛けるか足す．
+ *
+ * @param multiply true: dst = a * k, false: dst = a + k
+ */
+static Value arrayConstantNative(int argCount, Value* args, bool multiply) {
+    if (argCount != 3 || !sameShape(2, args)) return NIL_VAL;
+
+    int length = AS_TYPED_ARRAY(args[0])->length;
+    if (AS_TYPED_ARRAY(args[0])->kind == TYPED_FLOAT64) {
+        if (!IS_NUMBER(args[2])) return NIL_VAL;
+        double k = AS_NUMBER(args[2]);
+        if (multiply) {
+            float64Kernels.scale(FLOAT64_DATA(args[0]), FLOAT64_DATA(args[1]), k, length);
+        } else {
+            float64Kernels.offset(FLOAT64_DATA(args[0]), FLOAT64_DATA(args[1]), k, length);
+        }
+    } else {
+        int32_t k;
+        if (!toInt32(args[2], &k)) return NIL_VAL;
+        if (multiply) {
+            int32Scale(INT32_DATA(args[0]), INT32_DATA(args[1]), k, length);
+        } else {
+            int32Offset(INT32_DATA(args[0]), INT32_DATA(args[1]), k, length);
+        }
+    }
+    return args[0];
+}
+
+/**
+ * arrayScale(dst, a, k): dst = a * k
+ */
+static Value arrayScaleNative(int argCount, Value* args) {
+    return arrayConstantNative(argCount, args, true);
+}
+
+/**
+ * arrayOffset(dst, a, k): dst = a + k
+ */
+static Value arrayOffsetNative(int argCount, Value* args) {
+    return arrayConstantNative(argCount, args, false);
+}
+
+/**
+ * arrayFill(dst, value): 全ての要素を value にする．
+ */
+static Value arrayFillNative(int argCount, Value* args) {
+    if (argCount != 2 || !IS_TYPED_ARRAY(args[0])) return NIL_VAL;
+
+    int length = AS_TYPED_ARRAY(args[0])->length;
+    if (AS_TYPED_ARRAY(args[0])->kind == TYPED_FLOAT64) {
+        if (!IS_NUMBER(args[1])) return NIL_VAL;
+        float64Kernels.fill(FLOAT64_DATA(args[0]), AS_NUMBER(args[1]), length);
+    } else {
+        int32_t value;
+        if (!toInt32(args[1], &value)) return NIL_VAL;
+        int32Fill(INT32_DATA(args[0]), value, length);
+    }
+    return args[0];
+}
+
+/**
+ * @return 要素の総和．@note Int32Array の総和は 64 ビットで累積するので，途中で巡回しない．
+ */
+static Value arraySumNative(int argCount, Value* args) {
+    if (argCount != 1 || !IS_TYPED_ARRAY(args[0])) return NIL_VAL;
+
+    int length = AS_TYPED_ARRAY(args[0])->length;
+    if (AS_TYPED_ARRAY(args[0])->kind == TYPED_FLOAT64) return NUMBER_VAL(float64Kernels.sum(FLOAT64_DATA(args[0]), length));
+    return NUMBER_VAL((double)int32Sum(INT32_DATA(args[0]), length));
+}
+
+/**
+ * @return 2つの配列の内積．
+ */
+static Value arrayDotNative(int argCount, Value* args) {
+    if (argCount != 2 || !sameShape(2, args)) return NIL_VAL;
+
+    int length = AS_TYPED_ARRAY(args[0])->length;
+    if (AS_TYPED_ARRAY(args[0])->kind == TYPED_FLOAT64) {
+        return NUMBER_VAL(float64Kernels.dot(FLOAT64_DATA(args[0]), FLOAT64_DATA(args[1]), length));
+    }
+    return NUMBER_VAL((double)int32Dot(INT32_DATA(args[0]), INT32_DATA(args[1]), length));
+}
+
+/**
+ * @return 要素の最小値か最大値．@note 空の配列の場合は nil を返す．
+ *
+ * @param min true: 最小値, false: 最大値
+ */
+static Value arrayExtremumNative(int argCount, Value* args, bool min) {
+    if (argCount != 1 || !IS_TYPED_ARRAY(args[0])) return NIL_VAL;
+
+    int length = AS_TYPED_ARRAY(args[0])->length;
+    if (length == 0) return NIL_VAL;
+    if (AS_TYPED_ARRAY(args[0])->kind == TYPED_FLOAT64) {
+        double* data = FLOAT64_DATA(args[0]);
+        return NUMBER_VAL(min ? float64Kernels.min(data, length) : float64Kernels.max(data, length));
+    }
+    int32_t* data = INT32_DATA(args[0]);
+    return NUMBER_VAL(min ? int32Min(data, length) : int32Max(data, length));
+}
+
+static Value arrayMinNative(int argCount, Value* args) {
+    return arrayExtremumNative(argCount, args, true);
+}
+
+static Value arrayMaxNative(int argCount, Value* args) {
+    return arrayExtremumNative(argCount, args, false);
+}
+
+#undef FLOAT64_DATA
+#undef INT32_DATA
+
 static void resetStack() {
     vm.stackTop = vm.stack; // NOTE: vm.stack はスタック配列の先頭アドレスを表す．
     vm.frameCount = 0;
@@ -63,25 +481,76 @@ static void defineNative(const char* name, NativeFn function) {
 
 void initVM() {
     resetStack();
+    initGcStats();
     vm.objects = NULL;
+    vm.youngObjects = NULL;
+    vm.unsweptObjects = NULL;
+    vm.nurserySize = 256 * 1024;
+    vm.nextMinorGC = vm.nurserySize;
+    vm.gcCompactThreshold = 50;
+    vm.gcCompactPending = false;
+    vm.gcMinor = false;
+    vm.rememberedCount = 0;
+    vm.rememberedCapacity = 0;
+    vm.remembered = NULL;
+    vm.youngStringCount = 0;
+    vm.youngStringCapacity = 0;
+    vm.youngStrings = NULL;
     vm.bytesAllocated = 0;
-    vm.nextGC = 1024 * 1024;
+    vm.nextGC = GC_MIN_HEAP;
+    vm.gcOverheadTarget = 5;
+    vm.gcMaxHeap = 0;
+    vm.heapLimit = 0;
+    vm.outOfMemoryHandler = NULL;
+    vm.heapLimitExceeded = false;
     vm.grayCount = 0;
     vm.grayCapacity = 0;
     vm.grayStack = NULL;
+    vm.gcMarking = false;
+    vm.gcSliceBudget = 1000;
+    vm.nextGCStep = 0;
+
+    // デフォルトでは，利用可能なコア数だけマーキングスレッドを使う．
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    vm.gcThreads = cores < 1 ? 1 : cores > GC_MAX_MARK_THREADS ? GC_MAX_MARK_THREADS : (int)cores;
 
     initTable(&vm.globals);
     initTable(&vm.strings);
+    initValueArray(&vm.methodNames);
 
     vm.initString = NULL;
     vm.initString = copyString("init", 4);
 
     defineNative("clock", clockNative);
+    defineNative("gcStat", gcStatNative);
+    defineNative("length", lengthNative);
+    defineNative("push", pushNative);
+    defineNative("pop", popNative);
+    defineNative("slice", sliceNative);
+    defineNative("keys", keysNative);
+    defineNative("values", valuesNative);
+    defineNative("has", hasNative);
+    defineNative("remove", removeNative);
+
+    initKernels();
+    defineNative("Float64Array", float64ArrayNative);
+    defineNative("Int32Array", int32ArrayNative);
+    defineNative("arrayAdd", arrayAddNative);
+    defineNative("arrayMul", arrayMulNative);
+    defineNative("arrayFma", arrayFmaNative);
+    defineNative("arrayScale", arrayScaleNative);
+    defineNative("arrayOffset", arrayOffsetNative);
+    defineNative("arrayFill", arrayFillNative);
+    defineNative("arraySum", arraySumNative);
+    defineNative("arrayDot", arrayDotNative);
+    defineNative("arrayMin", arrayMinNative);
+    defineNative("arrayMax", arrayMaxNative);
 }
 
 void freeVM() {
     freeTable(&vm.globals);
     freeTable(&vm.strings);
+    freeValueArray(&vm.methodNames);
     vm.initString = NULL;
     freeObjects();
 }
@@ -120,10 +589,14 @@ static bool call(ObjClosure* closure, int argCount) {
         return false;
     }
 
-    CallFrame* frame = &vm.frames[vm.frameCount++];
+    CallFrame* frame = &vm.frames[vm.frameCount];
     frame->closure = closure;
     frame->ip = closure->function->chunk.code;
     frame->slots = vm.stackTop - argCount - 1; // スタックスロットの 0 番目は予約済み（関数オブジェクト自身が配置される）ので -1 が必要．
+
+    // @note プロファイラのシグナルハンドラが初期化前のフレームを読まないように，初期化し終えてからフレームを増やす．ref. プロファイリング
+    __atomic_signal_fence(__ATOMIC_RELEASE);
+    vm.frameCount++;
     return true;
 }
 
@@ -148,9 +621,8 @@ static bool callValue(Value callee, int argCount) {
                 ObjClass* klass = AS_CLASS(callee);
                 vm.stackTop[-argCount - 1] = OBJ_VAL(newInstance(klass));
 
-                Value initializer;
-                if (tableGet(&klass->methods, vm.initString, &initializer)) {
-                    return call(AS_CLOSURE(initializer), argCount);
+                if (klass->initializer != NULL) {
+                    return call(klass->initializer, argCount);
                 } else if (argCount != 0) {
                     runtimeError("Expected 0 arguments but got %d.", argCount);
                     return false;
@@ -180,12 +652,12 @@ static bool callValue(Value callee, int argCount) {
  * 所与の name に一致するメソッドを呼び出す．
  */
 static bool invokeFromClass(ObjClass* klass, ObjString* name, int argCount) {
-    Value method;
-    if (!tableGet(&klass->methods, name, &method)) {
+    ObjClosure* method = findMethod(klass, name);
+    if (method == NULL) {
         runtimeError("Undefined property '%s'.", name->chars);
         return false;
     }
-    return call(AS_CLOSURE(method), argCount);
+    return call(method, argCount);
 }
 
 /**
@@ -201,8 +673,9 @@ static bool invoke(ObjString* name, int argCount) {
 
     ObjInstance* instance = AS_INSTANCE(receiver);
 
+    // @note 一度もフィールド名として使われていない名前なら，フィールドを探すまでもない．ref. メソッドの仮想関数表
     Value value;
-    if (tableGet(&instance->fields, name, &value)) {
+    if (name->obj.isFieldName && tableGet(&instance->fields, name, &value)) {
         /**
          * 関数が格納されているフィールドを呼び出す場合
          *
@@ -226,18 +699,45 @@ static bool invoke(ObjString* name, int argCount) {
  *         false: 所与のメソッドが存在しなかった．
  */
 static bool bindMethod(ObjClass* klass, ObjString* name) {
-    Value method;
-    if (!tableGet(&klass->methods, name, &method)) {
+    ObjClosure* method = findMethod(klass, name);
+    if (method == NULL) {
         runtimeError("Undefined property '%s'.", name->chars);
         return false;
     }
 
-    ObjBoundMethod* bound = newBoundMethod(peek(0), AS_CLOSURE(method));
+    ObjBoundMethod* bound = newBoundMethod(peek(0), method);
     pop(); // receiver (=Instance)
     push(OBJ_VAL(bound));
     return true;
 }
 
+/**
+ * リストや型付き配列の添字を検査する．
+ *
+ * @param length 配列の要素数
+ * @return true: 所与の値が範囲内の整数で，その添字を index に格納した．false: 不正な添字だった（実行時エラーを報告済み）．
+ */
+static bool arrayIndex(int length, Value value, int* index) {
+    if (!IS_NUMBER(value)) {
+        runtimeError("Index must be an integer.");
+        return false;
+    }
+
+    // NOTE: 範囲を先に確かめてから int に変換しないと，巨大な数値で未定義動作になる．
+    double number = AS_NUMBER(value);
+    if (number < 0 || number >= length) {
+        runtimeError("Index out of range.");
+        return false;
+    }
+    if (number != (int)number) {
+        runtimeError("Index must be an integer.");
+        return false;
+    }
+
+    *index = (int)number;
+    return true;
+}
+
 static ObjUpvalue* captureUpvalue(Value* local) {
     ObjUpvalue* prevUpvalue = NULL;
     ObjUpvalue* upvalue = vm.openUpvalues;
@@ -280,6 +780,7 @@ static void closeUpvalues(Value* last) {
         && vm.openUpvalues->location >= last
     ) {
         ObjUpvalue* upvalue = vm.openUpvalues;
+        writeBarrier((Obj*)upvalue, *upvalue->location); // スタック（ルート）から外れる値をヒープ上の上位値に移すので，書き込みバリアを通す．
         upvalue->closed = *upvalue->location; // 変数の値をヒープ（closed）にコピーする．
         upvalue->location = &upvalue->closed; // 参照先をスタックからヒープ（closed）に切り替える．
         vm.openUpvalues = upvalue->next; // open upvalue のリストから削除する（処理済みの upvalue をリストの追跡から外す）．
@@ -292,10 +793,149 @@ static void closeUpvalues(Value* last) {
 static void defineMethod(ObjString* name) {
     Value method = peek(0); // クロージャ
     ObjClass* klass = AS_CLASS(peek(1));
+    writeBarrier((Obj*)klass, method);
     tableSet(&klass->methods, name, method);
     pop(); // クロージャをクリアする．
 }
 
+/**
+ * @return 所与のメソッド名のスロット番号．@note まだ番号がなければ，新しく振る．ref. メソッドの仮想関数表
+ *
+ * @warning name は，GCから到達可能な状態で渡すこと（一覧の拡張で割り当てが発生しうる）．
+ */
+static int methodSlot(ObjString* name) {
+    if (name->methodSlot < 0) {
+        writeBarrier(NULL, OBJ_VAL(name)); // メソッド名の一覧はルートなので，所有者はいない．
+        writeValueArray(&vm.methodNames, OBJ_VAL(name));
+        name->methodSlot = vm.methodNames.count - 1;
+    }
+    return name->methodSlot;
+}
+
+/**
+ * スーパークラスのメソッド表と初期化メソッドを，サブクラスに引き継ぐ．
+ *
+ * @note この後の OP_METHOD で定義されたメソッドは，封印する時に引き継いだものを上書き（オーバーライド）する．
+ */
+static void inheritMethods(ObjClass* subclass, ObjClass* superclass) {
+    subclass->initializer = superclass->initializer;
+
+    if (superclass->vtableCount > 0) {
+        ObjClosure** vtable = ALLOCATE(ObjClosure*, superclass->vtableCount);
+        memcpy(vtable, superclass->vtable, sizeof(ObjClosure*) * superclass->vtableCount);
+        subclass->vtable = vtable;
+        subclass->vtableCount = superclass->vtableCount;
+    } else if (superclass->sparseMethods != NULL) {
+        MethodEntry* entries = ALLOCATE(MethodEntry, superclass->sparseCapacity);
+        memcpy(entries, superclass->sparseMethods, sizeof(MethodEntry) * superclass->sparseCapacity);
+        subclass->sparseMethods = entries;
+        subclass->sparseCapacity = superclass->sparseCapacity;
+    }
+}
+
+/**
+ * クラスのメソッド表に，所与のスロット番号のメソッドを追加／上書きする．@warning 表には，そのスロットを収める余地があること．
+ */
+static void setMethod(ObjClass* klass, int slot, ObjClosure* method) {
+    if (klass->sparseMethods == NULL) {
+        klass->vtable[slot] = method;
+        return;
+    }
+
+    int mask = klass->sparseCapacity - 1;
+    int index = slot & mask;
+    while (klass->sparseMethods[index].slot >= 0 && klass->sparseMethods[index].slot != slot) {
+        index = (index + 1) & mask; // 線形探針
+    }
+    klass->sparseMethods[index].slot = slot;
+    klass->sparseMethods[index].method = method;
+}
+
+/**
+ * クラス本文で定義されたメソッドを，スロット番号で引けるメソッド表に固める．ref. メソッドの仮想関数表
+ *
+ * @note 引き継いだメソッドと合わせて，スロット番号の上限がメソッド数の VTABLE_MAX_SPARSITY 倍に収まれば平坦な vtable に，
+ *       収まらなければスロット番号をキーにしたハッシュ表にする．
+ * @note 封印した後は，メソッドのハッシュテーブルは使わないので解放する．
+ */
+static void sealClass(ObjClass* klass) {
+    Table* methods = &klass->methods;
+
+    // 引き継いだメソッドの数と，スロット番号の上限
+    int count = 0;
+    int limit = klass->vtableCount;
+    for (int i = 0; i < klass->vtableCount; i++) {
+        if (klass->vtable[i] != NULL) count++;
+    }
+    for (int i = 0; i < klass->sparseCapacity; i++) {
+        int slot = klass->sparseMethods[i].slot;
+        if (slot < 0) continue;
+        count++;
+        if (slot + 1 > limit) limit = slot + 1;
+    }
+
+    // 本文で定義したメソッドにスロット番号を振りながら，オーバーライドではない新しいメソッドを数える．
+    for (int i = 0; i < methods->capacity; i++) {
+        ObjString* name = methods->entries[i].key;
+        if (name == NULL) continue;
+
+        int slot = methodSlot(name);
+        if (findMethod(klass, name) == NULL) count++;
+        if (slot + 1 > limit) limit = slot + 1;
+    }
+
+    if (limit == 0) {
+        freeTable(methods);
+        return;
+    }
+
+    // 新しい表を確保し終えてから，引き継いだ表と入れ替える．@note 確保の途中でメモリ不足になっても，クラスは引き継いだ状態のまま残る．
+    ObjClosure** oldVtable = klass->vtable;
+    int oldVtableCount = klass->vtableCount;
+    MethodEntry* oldSparse = klass->sparseMethods;
+    int oldSparseCapacity = klass->sparseCapacity;
+
+    if (limit <= VTABLE_MIN_SIZE || limit <= count * VTABLE_MAX_SPARSITY) {
+        ObjClosure** vtable = ALLOCATE(ObjClosure*, limit);
+        for (int i = 0; i < limit; i++) vtable[i] = NULL;
+        klass->vtable = vtable;
+        klass->vtableCount = limit;
+        klass->sparseMethods = NULL;
+        klass->sparseCapacity = 0;
+    } else {
+        int capacity = 8;
+        while (capacity < count * 2) capacity *= 2;
+        MethodEntry* entries = ALLOCATE(MethodEntry, capacity);
+        for (int i = 0; i < capacity; i++) entries[i] = (MethodEntry){-1, NULL};
+        klass->vtable = NULL;
+        klass->vtableCount = 0;
+        klass->sparseMethods = entries;
+        klass->sparseCapacity = capacity;
+    }
+
+    for (int i = 0; i < oldVtableCount; i++) {
+        if (oldVtable[i] != NULL) setMethod(klass, i, oldVtable[i]);
+    }
+    for (int i = 0; i < oldSparseCapacity; i++) {
+        if (oldSparse[i].slot >= 0) setMethod(klass, oldSparse[i].slot, oldSparse[i].method);
+    }
+    FREE_ARRAY(ObjClosure*, oldVtable, oldVtableCount);
+    FREE_ARRAY(MethodEntry, oldSparse, oldSparseCapacity);
+
+    for (int i = 0; i < methods->capacity; i++) {
+        Entry* entry = &methods->entries[i];
+        if (entry->key == NULL) continue;
+
+        writeBarrier((Obj*)klass, entry->value);
+        setMethod(klass, entry->key->methodSlot, AS_CLOSURE(entry->value));
+    }
+
+    ObjClosure* initializer = findMethod(klass, vm.initString);
+    if (initializer != NULL) klass->initializer = initializer;
+
+    freeTable(methods);
+}
+
 /**
  * @return true: 入力が Falsey な値（nil or false）, false: 入力が Falsey ではない値
  */
@@ -308,16 +948,26 @@ static void concatenate() {
      * @warning pop で取得すると，結合した文字列をヒープに割り当てるタイミングで
      *          GCが動作した場合に，元の文字列が失われてしまうリスクがある．
      */
+    int length = stringLength(AS_OBJ(peek(0))) + stringLength(AS_OBJ(peek(1)));
+
+    // 長い文字列は，コピーもハッシュの計算もせずにロープで繋ぐだけにする．ref. ロープ
+    if (length >= ROPE_MIN_LENGTH) {
+        ObjRope* rope = newRope(AS_OBJ(peek(1)), AS_OBJ(peek(0)));
+        pop();
+        pop();
+        push(OBJ_VAL(rope));
+        return;
+    }
+
+    // @note ロープは ROPE_MIN_LENGTH 文字以上なので，ここに来るのは ObjString 同士だけ．
     ObjString* b = AS_STRING(peek(0));
     ObjString* a = AS_STRING(peek(1));
 
-    int length = a->length + b->length;
-    char* chars = ALLOCATE(char, length + 1); // ターミネータ（\0）のために + 1
-    memcpy(chars, a->chars, a->length);
-    memcpy(chars + a->length, b->chars, b->length); // chars の先頭から a->length バイト進んだ位置から，b の内容を b->length バイト分コピーする．
-    chars[length] = '\0';
+    ObjString* result = allocateString(length); // @note 文字配列もオブジェクトと一緒に割り当てられるので，その場で組み立てる．
+    memcpy(result->chars, a->chars, a->length);
+    memcpy(result->chars + a->length, b->chars, b->length); // chars の先頭から a->length バイト進んだ位置から，b の内容を b->length バイト分コピーする．
+    result->chars[length] = '\0'; // @note インターン化はしない．ref. 遅延インターン化
 
-    ObjString* result = takeString(chars, length);
     // 連結した文字列ヒープに割り当ててから，元の値をスタックからポップする（GCの誤動作対策）．
     pop();
     pop();
@@ -407,6 +1057,10 @@ static InterpretResult run() {
         );
 #endif
 
+#ifdef DEBUG_COUNT_OPCODES
+        countInstruction(frame->closure->function, *frame->ip);
+#endif
+
         uint8_t instruction;
 
         // 命令（バイトコード）のデコード（ディスパッチ）を行う．
@@ -443,6 +1097,7 @@ static InterpretResult run() {
             }
             case OP_DEFINE_GLOBAL: {
                 ObjString* name = READ_STRING(); // オペランドの読み出し
+                writeBarrier(NULL, peek(0)); // グローバル変数の表はルートなので，所有者はいない．
                 tableSet(&vm.globals, name, peek(0));
                 // NOTE: REPL セッションでの利便性維持のため，変数が定義済みかどうかをチェックしない． ＝ 変数の再定義を許容する．
                 pop(); // NOTE: ガベージコレクション対策のため，ハッシュ表に値（peek(0)）が追加し終わってからポップする．
@@ -450,6 +1105,7 @@ static InterpretResult run() {
             }
             case OP_SET_GLOBAL: {
                 ObjString* name = READ_STRING();
+                writeBarrier(NULL, peek(0));
                 if (tableSet(&vm.globals, name, peek(0))) {
                     /**
                      * 新規エントリへの追加の場合，変数が未定義ということなので，
@@ -470,6 +1126,7 @@ static InterpretResult run() {
             }
             case OP_SET_UPVALUE: {
                 uint8_t slot = READ_BYTE();
+                writeBarrier((Obj*)frame->closure->upvalues[slot], peek(0));
                 *frame->closure->upvalues[slot]->location = peek(0);
                 // 代入は式なのでスタックの値はポップせずに残しておく．
                 break;
@@ -484,7 +1141,7 @@ static InterpretResult run() {
                 ObjString* name = READ_STRING();
 
                 Value value;
-                if (tableGet(&instance->fields, name, &value)) {
+                if (name->obj.isFieldName && tableGet(&instance->fields, name, &value)) {
                     pop(); // Instance
                     push(value);
                     break;
@@ -504,13 +1161,154 @@ static InterpretResult run() {
                 }
 
                 ObjInstance* instance = AS_INSTANCE(peek(1));
+                ObjString* name = READ_STRING();
+                name->obj.isFieldName = true; // ref. メソッドの仮想関数表
                 // note: プロパティが存在しない場合は新規追加されるので，存在チェックは不要．
-                tableSet(&instance->fields, READ_STRING(), peek(0));
+                writeBarrier((Obj*)instance, peek(0));
+                tableSet(&instance->fields, name, peek(0));
                 Value value = pop();
                 pop(); // Instance
                 push(value);
                 break;
             }
+            case OP_BUILD_LIST: {
+                int count = READ_BYTE();
+                ObjList* list = newList();
+                push(OBJ_VAL(list)); // GC が勝手にメモリを開放しないように一旦VMのスタックにプッシュする．
+                if (count > 0) {
+                    list->items.values = GROW_ARRAY(Value, NULL, 0, count);
+                    list->items.capacity = count;
+                }
+
+                Value* elements = vm.stackTop - 1 - count;
+                for (int i = 0; i < count; i++) {
+                    writeBarrier((Obj*)list, elements[i]);
+                    list->items.values[i] = elements[i];
+                }
+                list->items.count = count;
+
+                vm.stackTop = elements; // 要素とリスト自身をまとめてポップする．
+                push(OBJ_VAL(list));
+                break;
+            }
+            case OP_BUILD_MAP: {
+                int count = READ_BYTE();
+                ObjMap* map = newMap();
+                push(OBJ_VAL(map)); // GC が勝手にメモリを開放しないように一旦VMのスタックにプッシュする．
+
+                Value* entries = vm.stackTop - 1 - count * 2; // キーと値が交互に積まれている．
+                for (int i = 0; i < count; i++) {
+                    // @note 正規化したキーはスタックに書き戻して，mapSet の割り当てでGCが走っても回収されないようにする．
+                    if (!mapKey(&entries[i * 2], true)) {
+                        runtimeError("Map key cannot be nil or NaN.");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    writeBarrier((Obj*)map, entries[i * 2]);
+                    writeBarrier((Obj*)map, entries[i * 2 + 1]);
+                    mapSet(&map->table, entries[i * 2], entries[i * 2 + 1]);
+                }
+
+                vm.stackTop = entries; // キーと値とマップ自身をまとめてポップする．
+                push(OBJ_VAL(map));
+                break;
+            }
+            case OP_INDEX_GET: {
+                if (IS_MAP(peek(1))) {
+                    Value key = peek(0);
+                    if (!mapKey(&key, false)) {
+                        runtimeError("Map key cannot be nil or NaN.");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+
+                    // @note 存在しないキーは nil になる．
+                    Value value;
+                    if (!mapGet(&AS_MAP(peek(1))->table, key, &value)) value = NIL_VAL;
+                    vm.stackTop -= 2; // Key, Map
+                    push(value);
+                    break;
+                }
+
+                if (IS_TYPED_ARRAY(peek(1))) {
+                    ObjTypedArray* array = AS_TYPED_ARRAY(peek(1));
+                    int index;
+                    if (!arrayIndex(array->length, peek(0), &index)) return INTERPRET_RUNTIME_ERROR;
+
+                    double element = array->kind == TYPED_FLOAT64 ? ((double*)array->data)[index] : ((int32_t*)array->data)[index];
+                    vm.stackTop -= 2; // Index, Array
+                    push(NUMBER_VAL(element));
+                    break;
+                }
+
+                if (!IS_LIST(peek(1))) {
+                    runtimeError("Only lists, maps and typed arrays can be indexed.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                ObjList* list = AS_LIST(peek(1));
+                int index;
+                if (!arrayIndex(list->items.count, peek(0), &index)) return INTERPRET_RUNTIME_ERROR;
+
+                Value value = list->items.values[index];
+                vm.stackTop -= 2; // Index, List
+                push(value);
+                break;
+            }
+            case OP_INDEX_SET: {
+                if (IS_MAP(peek(2))) {
+                    // @note 正規化したキーはスタックに書き戻して，mapSet の割り当てでGCが走っても回収されないようにする．
+                    if (!mapKey(&vm.stackTop[-2], true)) {
+                        runtimeError("Map key cannot be nil or NaN.");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+
+                    ObjMap* map = AS_MAP(peek(2));
+                    writeBarrier((Obj*)map, peek(1));
+                    writeBarrier((Obj*)map, peek(0));
+                    mapSet(&map->table, peek(1), peek(0));
+                    Value value = pop();
+                    vm.stackTop -= 2; // Key, Map
+                    push(value);
+                    break;
+                }
+
+                if (IS_TYPED_ARRAY(peek(2))) {
+                    ObjTypedArray* array = AS_TYPED_ARRAY(peek(2));
+                    int index;
+                    if (!arrayIndex(array->length, peek(1), &index)) return INTERPRET_RUNTIME_ERROR;
+
+                    // @note 要素はオブジェクトではないので，書き込みバリアは要らない．
+                    if (array->kind == TYPED_FLOAT64) {
+                        if (!IS_NUMBER(peek(0))) {
+                            runtimeError("Float64Array element must be a number.");
+                            return INTERPRET_RUNTIME_ERROR;
+                        }
+                        ((double*)array->data)[index] = AS_NUMBER(peek(0));
+                    } else if (!toInt32(peek(0), &((int32_t*)array->data)[index])) {
+                        runtimeError("Int32Array element must be a 32-bit integer.");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    Value value = pop();
+                    vm.stackTop -= 2; // Index, Array
+                    push(value);
+                    break;
+                }
+
+                if (!IS_LIST(peek(2))) {
+                    runtimeError("Only lists, maps and typed arrays can be indexed.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                ObjList* list = AS_LIST(peek(2));
+                int index;
+                if (!arrayIndex(list->items.count, peek(1), &index)) return INTERPRET_RUNTIME_ERROR;
+
+                writeBarrier((Obj*)list, peek(0));
+                list->items.values[index] = peek(0);
+                Value value = pop();
+                vm.stackTop -= 2; // Index, List
+                push(value);
+                break;
+            }
             case OP_GET_SUPER: {
                 ObjString* name = READ_STRING();
                 ObjClass* superclass = AS_CLASS(pop());
@@ -528,7 +1326,7 @@ static InterpretResult run() {
             case OP_GREATER:   BINARY_OP(BOOL_VAL, >); break;
             case OP_LESS:      BINARY_OP(BOOL_VAL, <); break;
             case OP_ADD: {
-                if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
+                if (isStringLike(peek(0)) && isStringLike(peek(1))) {
                     concatenate();
                 } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
                     double b = AS_NUMBER(pop());
@@ -577,6 +1375,46 @@ static InterpretResult run() {
             case OP_LOOP: {
                 uint16_t offset = READ_SHORT();
                 frame->ip -= offset;
+
+                // セーフポイント．ref. コンパクション
+                if (vm.gcCompactPending) compactHeap();
+                break;
+            }
+            case OP_FOR_NUM: {
+                Value* counter = &frame->slots[READ_BYTE()];
+                double step = AS_NUMBER(READ_CONSTANT()); // @note 増分が数値の定数であることは，コンパイラが確かめている．
+                uint8_t flags = READ_BYTE();
+                uint16_t offset = READ_SHORT();
+
+                // @note エラーメッセージは，元のインクリメント節（OP_ADD か OP_SUBTRACT）や条件節（比較演算）と揃える．
+                if (!IS_NUMBER(*counter)) {
+                    runtimeError(flags & FOR_NUM_SUBTRACT ? "Operands must be numbers." : "Operands must be two numbers or two strings.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                double value = flags & FOR_NUM_SUBTRACT ? AS_NUMBER(*counter) - step : AS_NUMBER(*counter) + step;
+                *counter = NUMBER_VAL(value);
+
+                if (!IS_NUMBER(peek(0))) {
+                    runtimeError("Operands must be numbers.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                double limit = AS_NUMBER(pop());
+
+                bool loop;
+                switch (flags & FOR_NUM_COMPARISON) {
+                    case FOR_NUM_LESS: loop = value < limit; break;
+                    case FOR_NUM_LESS_EQUAL: loop = !(value > limit); break; // @note NaN の扱いも元の !(i > limit) と揃える．
+                    case FOR_NUM_GREATER: loop = value > limit; break;
+                    default: loop = !(value < limit); break;
+                }
+
+                if (loop) {
+                    frame->ip -= offset;
+                    // セーフポイント．ref. コンパクション
+                    if (vm.gcCompactPending) compactHeap();
+                } else {
+                    push(BOOL_VAL(false)); // 条件値．@note 最初の判定で抜けた場合と同じく，ループの出口でポップされる．
+                }
                 break;
             }
             /**
@@ -643,6 +1481,7 @@ static InterpretResult run() {
                          */
                         closure->upvalues[i] = frame->closure->upvalues[index];
                     }
+                    writeBarrier((Obj*)closure, OBJ_VAL(closure->upvalues[i])); // 上位値の割り当て中にGCが進み，このクロージャがすでに黒になっている（または昇格している）可能性がある．
                 }
 
                 break;
@@ -664,6 +1503,9 @@ static InterpretResult run() {
                 vm.stackTop = frame->slots;
                 push(result);
                 frame = &vm.frames[vm.frameCount - 1];
+
+                // セーフポイント．ref. コンパクション
+                if (vm.gcCompactPending) compactHeap();
                 break;
             }
             case OP_CLASS:
@@ -677,20 +1519,24 @@ static InterpretResult run() {
                 }
 
                 ObjClass* subclass = AS_CLASS(peek(0));
+                writeBarrier((Obj*)subclass, superclass); // コピーされるメソッドは全てスーパークラスから辿れるので，スーパークラスを辿らせれば十分．
                 /**
                  * note: メソッドのオーバーライドの実装
                  *  この命令はどのメソッド宣言（OP_METHOD）よりも前に実行されるので，
-                 *  この時点で subclass->methods は空．
-                 *  ここで，スーパークラスのメソッドが全て追加された後に，
-                 *  OP_METHOD でサブクラスのメソッドが上書き（オーバーライド）する．
+                 *  ここで，スーパークラスのメソッドが全て引き継がれた後に，
+                 *  OP_END_CLASS でサブクラスのメソッドが上書き（オーバーライド）する．
                  */
-                tableAddAll(&AS_CLASS(superclass)->methods, &subclass->methods);
+                inheritMethods(subclass, AS_CLASS(superclass));
                 pop(); // Subclass
                 break;
             }
             case OP_METHOD:
                 defineMethod(READ_STRING());
                 break;
+            case OP_END_CLASS:
+                sealClass(AS_CLASS(peek(0)));
+                pop(); // Class
+                break;
         }
     }
 
@@ -701,7 +1547,7 @@ static InterpretResult run() {
 #undef BINARY_OP
 }
 
-InterpretResult interpret(const char* source) {
+static InterpretResult execute(const char* source) {
     // 簡単のため，コード全体が暗黙の main 関数のようなものにラップされているものとして扱う．
     ObjFunction* function = compile(source);
     if (function == NULL) return INTERPRET_COMPILE_ERROR;
@@ -719,3 +1565,32 @@ InterpretResult interpret(const char* source) {
 
     return run();
 }
+
+/**
+ * メモリ不足で割り当ての途中から戻ってきた後に，VMを次の実行に使える状態に戻す．ref. ヒープの上限
+ */
+static InterpretResult outOfMemoryError() {
+    abortCompile(); // コンパイル中だった場合に備える．
+    if (vm.heapLimit > 0 && vm.heapLimitExceeded) {
+        runtimeError("Out of memory: heap limit of %zu bytes exceeded.", vm.heapLimit);
+    } else {
+        runtimeError("Out of memory."); // システムのメモリが足りなかった．
+    }
+    return INTERPRET_RUNTIME_ERROR;
+}
+
+InterpretResult interpret(const char* source) {
+    jmp_buf handler;
+    InterpretResult result;
+
+    // @note setjmp() は，最初は 0 を返し，longjmp() で戻ってきた時は 0 以外を返す．
+    if (setjmp(handler) == 0) {
+        vm.outOfMemoryHandler = &handler;
+        result = execute(source);
+    } else {
+        result = outOfMemoryError();
+    }
+
+    vm.outOfMemoryHandler = NULL;
+    return result;
+}
@@ -1,6 +1,8 @@
 #ifndef clox_vm_h
 #define clox_vm_h
 
+#include <setjmp.h>
+
 #include "object.h"
 #include "table.h"
 #include "value.h"
@@ -51,6 +53,8 @@ typedef struct {
      */
     Table strings; // インターン化済みの文字列の一覧（ハッシュ表）
 
+    ValueArray methodNames; // スロット番号からメソッド名を引く一覧．ref. メソッドの仮想関数表
+
     ObjString* initString; // 初期化 init() のルックアップのための文字列．@note init() のルックアップ処理はインスタンス構築時に必ず呼び出されるので，高速化のためにここで定義して再利用する．
 
     ObjUpvalue* openUpvalues; // open upvalue の連結リストの先頭へのポインタ．ref. @note open upvalue:
@@ -64,7 +68,58 @@ typedef struct {
     size_t bytesAllocated; // VMが割り当てた管理メモリの総バイト数．
     size_t nextGC; // 次回の収集のトリガとなる閾値．@note この値を，生きているオブジェクトのメモリサイズより大きくなるように調整することで，スループットとレイテンシのバランスを取る．
 
-    Obj* objects; // 追跡用の Obj チェーン（リスト）の先頭へのポインタ
+    /**
+     * @note 適応的なヒープサイズ調整
+     *  生きているオブジェクトの固定倍（GC_HEAP_GROW_FACTOR）を閾値にすると，
+     *  小さなスクリプトでは不要なGCを繰り返し，大きなヒープでは必要以上に膨らむ．
+     *  そこで，サイクルごとに実測した生存率，割り当て速度，GCにかかった時間から，
+     *  GCに使う時間の割合が目標（vm.gcOverheadTarget）に収まるような次回の閾値を求め，
+     *  ヒープサイズの目標上限（vm.gcMaxHeap）があればそれを超えないように抑える．
+     */
+    int gcOverheadTarget; // GCに使ってよい実行時間の割合（%）の目標．@note 0 の場合は，固定倍の閾値に戻す．
+    size_t gcMaxHeap; // ヒープサイズの目標上限（バイト）．@note 0 の場合は上限なし．生きているオブジェクトだけでこれを超える場合は守れない（ソフトな上限）．
+
+    /**
+     * @note ヒープの上限
+     *  暴走したスクリプトがホストのメモリを食い尽くさないように，ヒープサイズに絶対に超えない上限を設ける．
+     *  割り当てが上限を超える場合は，まず緊急のフルGCを行い，それでも足りなければ，
+     *  割り当ての途中（C の関数呼び出しの奥深く）から longjmp で interpret() まで戻り，Lox のランタイムエラーにする．
+     *  プロセスは終了しないので，1つのプロセスで複数のVMを動かしても，1つのスクリプトの暴走が他を巻き込まない．
+     */
+    size_t heapLimit; // ヒープサイズの上限（バイト）．@note 0 の場合は上限なし．
+    jmp_buf* outOfMemoryHandler; // メモリ不足の時の戻り先．@note NULL の場合は戻り先がないので，プロセスを終了する．
+    bool heapLimitExceeded; // true: 直近のメモリ不足がヒープサイズの上限によるもの．false: システムのメモリが足りなかった．
+
+    Obj* objects; // 追跡用の Obj チェーン（リスト）の先頭へのポインタ．@note 世代別GCが有効な場合は，古い世代のオブジェクトだけが繋がる．
+
+    /**
+     * @note 遅延スイープ
+     *  GCの停止中にヒープ全体のチェーンを辿って白オブジェクトを解放する代わりに，
+     *  マーク済みのチェーンを丸ごと未スイープのチェーンに付け替えておき，
+     *  その後の割り当てのたびに少しずつ辿って回収する．スイープのコストが停止時間から外れる．
+     */
+    Obj* unsweptObjects; // まだスイープしていない古い世代の Obj チェーンの先頭へのポインタ．@note マークビットはGCサイクルの結果のまま残っている．
+
+    /**
+     * @note 世代別GC
+     *  ほとんどのオブジェクトは若いうちに死ぬ（世代別仮説）ので，
+     *  新しいオブジェクトだけを対象にした小さなGC（マイナーGC）を頻繁に行い，
+     *  ヒープ全体を対象にしたGC（メジャーGC）の頻度を下げる．
+     *  マイナーGCを生き延びたオブジェクトは古い世代に昇格する．
+     *
+     *  古いオブジェクトから若いオブジェクトへの参照は，書き込みバリアが記憶集合に記録しておき，
+     *  マイナーGCではそれもルートとして扱う．
+     */
+    Obj* youngObjects; // 若い世代の Obj チェーンの先頭へのポインタ
+    size_t nurserySize; // 何バイト割り当てるごとにマイナーGCを行うか．@note 0 の場合は世代別GCを無効にする．
+    size_t nextMinorGC; // 次回のマイナーGCのトリガとなる閾値．
+    bool gcMinor; // マイナーGCの実行中かどうか．@note この間，古いオブジェクトは暗黙のうちに黒として扱う．
+    int rememberedCount; // 記憶集合に登録されたオブジェクトの数．
+    int rememberedCapacity; // 記憶集合の動的配列の総容量
+    Obj** remembered; // 記憶集合．若いオブジェクトへの参照を持つ古いオブジェクトの動的配列．
+    int youngStringCount; // 若いうちにインターン化された文字列の数．
+    int youngStringCapacity; // 若いうちにインターン化された文字列の動的配列の総容量
+    ObjString** youngStrings; // 若いうちにインターン化された文字列．@note マイナーGCでは，文字列表全体ではなくこれだけを調べて，死んだものを表から外す．
 
     /**
      * @note 三色抽象化
@@ -75,6 +130,29 @@ typedef struct {
     int grayCount; // グレーオブジェクトの個数（動的配列内での利用済みの容量）．
     int grayCapacity; // グレーオブジェクトの動的配列の総容量
     Obj** grayStack; // グレーオブジェクトの動的配列．@note ダブルポインタ（Obj* の配列）
+
+    /**
+     * @note インクリメンタルGC
+     *  マーキングをミューテータ（プログラム本体）の実行と交互に，少しずつ（スライスごとに）進める方式．
+     *  1回の停止時間が，ヒープサイズではなくスライスの予算によって決まるようになる．
+     */
+    bool gcMarking; // インクリメンタルマーキングのサイクルが進行中かどうか．
+    int gcSliceBudget; // 1スライスで暗黒化するグレーオブジェクトの最大数．@note 0 以下の場合はインクリメンタルにせず，一度に全て回収する．
+    size_t nextGCStep; // マーキング中に，次のスライスを実行するトリガとなる閾値．
+
+    int gcThreads; // マーキングに使うスレッド数．@note 1 以下の場合はシングルスレッドでマーキングする．
+
+    /**
+     * @note コンパクション
+     *  オブジェクトを移動しないGCを長く回し続けると，生きているオブジェクトがまばらに残ったブロックが増え（断片化），
+     *  メモリ使用量が下がらず，キャッシュの局所性も悪くなる．
+     *  そこで，使用率の低いブロックから生きているオブジェクトを別のブロックに退避させて詰め直し，全ての参照を移動先に付け替える．
+     *
+     *  C のローカル変数が持つ Obj へのポインタは付け替えられないので，
+     *  GCの直後ではなく，命令ループのセーフポイント（ループの後方ジャンプや関数からの復帰）で実行する．
+     */
+    int gcCompactThreshold; // コンパクションを行うオブジェクトプールの断片化率（%）．@note 0 の場合はコンパクションを行わない．
+    bool gcCompactPending; // 次のセーフポイントでコンパクションを行うかどうか．
 } VM;
 
 typedef enum {